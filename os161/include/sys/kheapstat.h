@@ -0,0 +1,15 @@
+#ifndef _SYS_KHEAPSTAT_H_
+#define _SYS_KHEAPSTAT_H_
+
+/*
+ * Get struct kheapstats from the kernel
+ */
+#include <kern/kheapstat.h>
+
+/*
+ * Get the kernel heap's size-class usage and the physical memory
+ * fragmentation figures.
+ */
+int kheapstats(struct kheapstats *ks);
+
+#endif /* _SYS_KHEAPSTAT_H_ */
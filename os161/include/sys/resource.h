@@ -0,0 +1,16 @@
+#ifndef _SYS_RESOURCE_H_
+#define _SYS_RESOURCE_H_
+
+/*
+ * Get struct rusage from the kernel
+ */
+#include <kern/resource.h>
+
+/*
+ * Get CPU and scheduling statistics for process PID, or for the
+ * calling process if PID is 0. The process must not have been
+ * waited for yet.
+ */
+int getrusage(pid_t pid, struct rusage *ru);
+
+#endif /* _SYS_RESOURCE_H_ */
@@ -120,6 +120,14 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+int nanosleep(time_t seconds, unsigned long nanoseconds);
+/*
+ * setshare puts process PID (0 for the caller) in the proportional-share
+ * scheduling class with the given number of tickets, or back in the
+ * normal class with 0 tickets. -1 changes nothing. Returns the previous
+ * number of tickets. Children inherit their parent's setting.
+ */
+int setshare(pid_t pid, int tickets);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
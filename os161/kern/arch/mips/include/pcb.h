@@ -7,7 +7,11 @@
 
 #include <machine/setjmp.h>
 
-/* Size of kernel stacks (bytes) */
+/*
+ * Size of kernel stacks (bytes). Threads can be given smaller stacks
+ * (see thread_fork_user), but never bigger: SAME_STACK relies on each
+ * stack lying within one STACK_SIZE-aligned block.
+ */
 #define STACK_SIZE  4096
 
 /* Mask for extracting the stack base address of a kernel stack pointer */
@@ -54,11 +58,13 @@ struct pcb {
 void md_initpcb0(struct pcb *);
 
 /*
- * Initialize the pcb of a newly created thread. The newly created
- * thread, when it first runs, should call mi_threadstart, to which
- * data1, data2, and func are arguments.
+ * Initialize the pcb of a newly created thread, whose kernel stack is
+ * the STACKSIZE bytes at STACK. The newly created thread, when it
+ * first runs, should call mi_threadstart, to which data1, data2, and
+ * func are arguments.
  */
-void md_initpcb(struct pcb *, char *stack, void *data1, unsigned long data2,
+void md_initpcb(struct pcb *, char *stack, size_t stacksize,
+		void *data1, unsigned long data2,
 		void (*func)(void *, unsigned long));
 
 /*
@@ -7,6 +7,7 @@
 #include <vm.h>
 #include <machine/spl.h>
 #include <machine/tlb.h>
+#include <kern/kheapstat.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -59,6 +60,22 @@ free_kpages(vaddr_t addr)
 	(void)addr;
 }
 
+void
+vm_getfragstats(struct kheapstats *ks)
+{
+	/* Memory is never given back, so there's nothing to report. */
+	ks->khs_frames = ks->khs_freeframes = 0;
+	ks->khs_largestrun = ks->khs_largestblock = 0;
+}
+
+struct pageref **
+kpage_pagerefp(vaddr_t kvaddr)
+{
+	/* No coremap. */
+	(void)kvaddr;
+	return NULL;
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -49,7 +49,7 @@ md_initpcb0(struct pcb *pcb)
  * then jump to mi_threadstart.
  */
 void 
-md_initpcb(struct pcb *pcb, char *stack, 
+md_initpcb(struct pcb *pcb, char *stack, size_t stacksize,
 	   void *data1, unsigned long data2, 
 	   void (*func)(void *, unsigned long))
 {
@@ -57,7 +57,7 @@ md_initpcb(struct pcb *pcb, char *stack,
 	 * MIPS stacks grow down. What we get passed is just a hunk of
 	 * memory. So get the other end of it.
 	 */
-	u_int32_t stacktop = ((u_int32_t)stack) + STACK_SIZE;
+	u_int32_t stacktop = ((u_int32_t)stack) + stacksize;
 
 	/*
 	 * Set up a switchframe on the top of the stack, and point to it.
@@ -12,6 +12,12 @@
 #include <vfs.h>
 #include "syscall.h"
 #include <kern/unistd.h>
+#include <clock.h>
+#include <timeout.h>
+#include <rusage.h>
+#include <scheduler.h>
+#include <kmem_cache.h>
+#include <kern/kheapstat.h>
 
 // Kernel process table
 extern pcb_t * PCBs[MAX_PID];
@@ -20,6 +26,10 @@ extern struct thread* curthread;
 
 void destroy_pcb_unit(u_int32_t pID);
 
+/* Copies of the parent's trapframe, passed from sys_fork to md_forkentry. */
+static struct kmem_cache trapframe_cache =
+	KMEM_CACHE_INIT("trapframe", sizeof(struct trapframe), NULL, NULL);
+
 /*
  * System call handler.
  *
@@ -111,6 +121,18 @@ mips_syscall(struct trapframe *tf)
 		case SYS_sbrk:
 		err = sys_sbrk(tf->tf_a0, &retval);
 		break;
+		case SYS_nanosleep:
+		err = sys_nanosleep(tf->tf_a0, tf->tf_a1);
+		break;
+		case SYS_getrusage:
+		err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+		case SYS_setshare:
+		err = sys_setshare(tf->tf_a0, tf->tf_a1, &retval);
+		break;
+		case SYS_kheapstats:
+		err = sys_kheapstats((userptr_t)tf->tf_a0);
+		break;
 	    /* Add stuff here */
  
 	    default:
@@ -172,6 +194,7 @@ md_forkentry(void* tf, unsigned long vmspace)
 	as_activate(curthread->t_vmspace);
 
 	child_tf = *tf_parent;
+	kmem_cache_free(&trapframe_cache, tf_parent);
 	mips_usermode(&child_tf);
 
 	// we should never reach here
@@ -218,7 +241,7 @@ int sys_fork(struct trapframe *tf, int * retval){
 	struct thread *child_thread = NULL;
 	// duplicate the parent's trapframe, which is on this kernel thread's stack
 	// we need to copy the trapframe to kernel heap
-	struct  trapframe* child_tf = kmalloc(sizeof(struct trapframe));
+	struct  trapframe* child_tf = kmem_cache_alloc(&trapframe_cache);
 
 	if (child_tf == NULL) {
 		splx(spl);
@@ -228,7 +251,7 @@ int sys_fork(struct trapframe *tf, int * retval){
 
 
 	// create child thread/process
-	result =  thread_fork("child_process", 
+	result =  thread_fork_user("child_process", 
 		(void*)child_tf, (unsigned long)child_vmspace, 
 		md_forkentry,
 		&child_thread);
@@ -382,12 +405,8 @@ void destroy_pcb_unit(u_int32_t pID)
 	}
 	else
 	{
-		if(PCBs[pID]->mutex != NULL){
-			sem_destroy(PCBs[pID]->mutex);
-			PCBs[pID]->mutex = NULL;
-		}
 		PCBs[pID]->this_thread = NULL;
-		kfree(PCBs[pID]);
+		kmem_cache_free(&pcb_cache, PCBs[pID]);
 		PCBs[pID] = NULL;
 		splx(result);
 		return;
@@ -570,3 +589,89 @@ int sys_sbrk(int incr, int32_t* retval) {
 	as->heap_end += incr;
 	return 0;
 }
+
+
+/*
+ * Sleep for SECS seconds plus NSECS nanoseconds, rounded up to a whole
+ * number of hardclock ticks.
+ */
+int sys_nanosleep(time_t secs, unsigned long nsecs) {
+	int ticks;
+
+	if (secs < 0 || nsecs >= 1000000000) {
+		return EINVAL;
+	}
+	// keep secs * HZ from overflowing
+	if (secs >= 0x7fffffff / HZ - 1) {
+		return EINVAL;
+	}
+
+	ticks = secs * HZ + (nsecs + (1000000000 / HZ) - 1) / (1000000000 / HZ);
+	if (ticks == 0) {
+		thread_yield();
+		return 0;
+	}
+
+	thread_sleep_ticks(ticks);
+	return 0;
+}
+
+
+/*
+ * Get CPU and scheduling statistics for a process (0 means the
+ * caller).
+ */
+int sys_getrusage(int pid, userptr_t ru) {
+	struct rusage kru;
+	int result;
+
+	if (pid == 0) {
+		pid = curthread->pID;
+	}
+
+	result = pcb_getrusage(pid, &kru);
+	if (result) {
+		return result;
+	}
+
+	return copyout(&kru, ru, sizeof(kru));
+}
+
+
+/*
+ * Set the proportional-share tickets of a process (0 means the
+ * caller). Returns the old number; -1 just asks.
+ */
+int sys_setshare(int pid, int tickets, int32_t *retval) {
+	struct thread *t;
+	int spl, result = 0;
+
+	if (pid == 0) {
+		pid = curthread->pID;
+	}
+	if (pid < MIN_PID || pid >= MAX_PID) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	if (PCBs[pid] == NULL || PCBs[pid]->exited ||
+	    PCBs[pid]->this_thread == NULL) {
+		splx(spl);
+		return EINVAL;
+	}
+	t = PCBs[pid]->this_thread;
+	*retval = t->t_tickets;
+	if (tickets != -1) {
+		result = scheduler_setshare(t, tickets);
+	}
+	splx(spl);
+
+	return result;
+}
+
+int sys_kheapstats(userptr_t ks) {
+	struct kheapstats kks;
+
+	kheap_getstats(&kks);
+	return copyout(&kks, ks, sizeof(kks));
+}
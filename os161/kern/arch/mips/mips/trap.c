@@ -82,7 +82,7 @@ mips_trap(struct trapframe *tf)
 	/* Make sure we haven't run off our stack */
 	if (curthread != NULL && curthread->t_stack != NULL) {
 		assert((vaddr_t)tf > (vaddr_t)curthread->t_stack);
-		assert((vaddr_t)tf < (vaddr_t)(curthread->t_stack+STACK_SIZE));
+		assert((vaddr_t)tf < (vaddr_t)(curthread->t_stack+curthread->t_stacksize));
 	}
 
 	/* Interrupt? Call the interrupt handler and return. */
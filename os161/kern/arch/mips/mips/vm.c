@@ -14,6 +14,8 @@
 #include <uio.h>
 #include <vnode.h>
 #include <kern/stat.h>
+#include <kmem_cache.h>
+#include <kern/kheapstat.h>
 /*****************************************************************************************/
 #define PTE_PRESENT 0x00000800
 #define PTE_SWAPPED 0x00000400
@@ -40,9 +42,42 @@ int get_free_frame_kernel();
 /********************************* Some bookkeepping data*********************************/
 int vm_bootstraped = 0;
 int total_disk_slots;
+/*
+ * Pre-zeroed frames. The idle loop zeroes FREE frames and marks them
+ * ZEROED, so a fault on a fresh page can usually skip the bzero.
+ * The free frames the buddy allocator has are also kept on one list
+ * per state (see frame_list_insert), so both the idle loop and
+ * whoever wants a frame in a particular state can find one at once.
+ */
+struct frame_list {
+	int head;	// frame ids, -1 if empty
+	int tail;
+	int count;
+};
+static struct frame_list free_plain;	// FREE frames, most recently freed first
+static struct frame_list free_zeroed;	// ZEROED frames
+static u_int32_t zero_hits;	/* faults that got a pre-zeroed frame */
+static u_int32_t zero_misses;	/* faults that had to zero their own */
+static u_int32_t zero_idle;	/* frames zeroed by the idle loop */
+/*
+ * Buddy allocator over the coremap (see buddy_put). buddy_free[k] is the
+ * first frame of a list of free blocks of 2^k frames; buddy_base is the
+ * first frame it manages, the ones before it being taken at boot.
+ */
+#define BUDDY_NORDERS 11	/* blocks of up to 1024 frames */
+static int buddy_free[BUDDY_NORDERS];
+static int buddy_nfree[BUDDY_NORDERS];
+static int buddy_base;
 /*****************************************************************************************/
 paddr_t load_swapped_page(struct addrspace* as, vaddr_t va);
 int get_free_frame();
+int get_zeroed_frame();
+static int find_free_frame();
+static void buddy_put(int frame_id);
+static int buddy_alloc(int npages);
+static void coremap_claim(int frame_id);
+static int coremap_claim_run(int npages);
+static void frame_list_insert(int frame_id);
 
 void swapping_init(){
 	// for swapping subsystem
@@ -104,6 +139,7 @@ vm_bootstrap(void)
 			coremap[i].mapped_vaddr = PADDR_TO_KVADDR(coremap[i].frame_start);
 			coremap[i].state = FIXED;
 			coremap[i].num_pages_allocated = 1;
+			coremap[i].pageref = NULL;
 		} else {
 			// free pages 
 			coremap[i].addrspace = NULL;
@@ -112,6 +148,7 @@ vm_bootstrap(void)
 			coremap[i].mapped_vaddr = 0xDEADBEEF; // LOL
 			coremap[i].state = FREE;
 			coremap[i].num_pages_allocated = 0;			
+			coremap[i].pageref = NULL;
 		}
 	}
 	// globals
@@ -122,6 +159,25 @@ vm_bootstrap(void)
 		if ((coremap[i].state != FREE && coremap[i].state != FIXED) || ((coremap[i].frame_start % PAGE_SIZE) != 0)) 
 			panic("error initializing the coremap"); 
 	}
+	// hand all the free frames to the buddy allocator
+	for (i = 0; i < BUDDY_NORDERS; i++) {
+		buddy_free[i] = -1;
+		buddy_nfree[i] = 0;
+	}
+	for (i = 0; i < num_frames; i++) {
+		coremap[i].buddy_order = -1;
+		coremap[i].buddy_next = coremap[i].buddy_prev = -1;
+		coremap[i].free_next = coremap[i].free_prev = -1;
+	}
+	free_plain.head = free_plain.tail = -1;
+	free_plain.count = 0;
+	free_zeroed.head = free_zeroed.tail = -1;
+	free_zeroed.count = 0;
+	buddy_base = fixed_pages;
+	for (i = fixed_pages; i < num_frames; i++) {
+		buddy_put(i);
+		frame_list_insert(i);
+	}
 	/**************************************** END of init ******************************************/
 	// TODO: we may want to set some flags to indicate that vm has already bootstrapped, 
 	vm_bootstraped = 1;
@@ -157,7 +213,7 @@ int evict_or_swap_with_avoidance(paddr_t avoid){
 		kicked_ass_page = random() % num_frames;
 	} while (coremap[kicked_ass_page].state == FIXED 
 				|| coremap[kicked_ass_page].frame_start == avoid
-				|| coremap[kicked_ass_page].state == FREE);
+				|| FRAME_IS_FREE(coremap[kicked_ass_page]));
 
 	int disk_slot;
 	if (coremap[kicked_ass_page].state == DIRTY) {
@@ -191,7 +247,7 @@ int evict_or_swap_kernel(){
 	int kicked_ass_page;
 	int i = 0;
 	for (; i < num_frames; i++){
-		if(coremap[i].state != FIXED) {
+		if(coremap[i].state != FIXED && !FRAME_IS_FREE(coremap[i])) {
 			kicked_ass_page = i;
 			break;
 		}
@@ -242,7 +298,7 @@ int evict_or_swap(){
 	do{
 		kicked_ass_page = random() % num_frames;
 	} while (coremap[kicked_ass_page].state == FIXED 
-				|| coremap[kicked_ass_page].state == FREE);
+				|| FRAME_IS_FREE(coremap[kicked_ass_page]));
 
 	int disk_slot;
 	if (coremap[kicked_ass_page].state == DIRTY) {
@@ -278,23 +334,17 @@ paddr_t alloc_page_userspace_with_avoidance(struct addrspace * as, vaddr_t va, p
 	assert(curspl > 0);
 	// passed in virtual address shall be page-aligned
 	assert((va & PAGE_FRAME) == va);
-	int i = 0;
-	int kicked_ass_page = -1;
-	// go through the coremap check if there's a free page
-	for (; i < num_frames; i++) {
-		if (coremap[i].state == FREE) {
-			kicked_ass_page = i;
-			break;
-		}
-	}
+	// check if there's a free page
+	int kicked_ass_page = find_free_frame();
 	if (kicked_ass_page == -1) {
 		// no free page available right now --> we need to evict/swap a page that
 		// does not have paddr of avoid
 		kicked_ass_page = evict_or_swap_with_avoidance(avoid);
 	}
 	assert(kicked_ass_page >= 0);
-	assert(coremap[kicked_ass_page].state == FREE || coremap[kicked_ass_page].state == CLEAN);
+	assert(FRAME_IS_FREE(coremap[kicked_ass_page]) || coremap[kicked_ass_page].state == CLEAN);
 	// now update coremap entry
+	coremap_claim(kicked_ass_page);
 	coremap[kicked_ass_page].addrspace = as;
 	coremap[kicked_ass_page].state = DIRTY; 
 	coremap[kicked_ass_page].mapped_vaddr = va;
@@ -311,10 +361,10 @@ paddr_t alloc_page_userspace(vaddr_t va) {
 	assert(curspl > 0);
 	// passed in virtual address shall be page-aligned
 	assert((va & PAGE_FRAME) == va);
-	int kicked_ass_page = get_free_frame();
+	int kicked_ass_page = get_zeroed_frame();
 
-	assert(coremap[kicked_ass_page].state == FREE || coremap[kicked_ass_page].state == CLEAN);
 	// now update coremap entry
+	coremap_claim(kicked_ass_page);
 	coremap[kicked_ass_page].addrspace = curthread->t_vmspace;
 	coremap[kicked_ass_page].state = DIRTY; // newly allocated user page shall start DIRTY
 	coremap[kicked_ass_page].mapped_vaddr = va;
@@ -333,6 +383,10 @@ void evict_or_swap_multiple(int starting_frame, size_t npages){
 	for (i = starting_frame; i < npages + starting_frame; i++) {
 		// come on, don't let me down...
 		assert(coremap[i].state != FIXED);
+		if (FRAME_IS_FREE(coremap[i])) {
+			// nothing to evict
+			continue;
+		}
 		int disk_slot;
 		if (coremap[i].state == DIRTY) {
 			// page is dirty, swap out :)
@@ -367,85 +421,57 @@ vaddr_t alloc_one_page() {
 	assert(curspl > 0);
 	int kicked_ass_page = get_free_frame_kernel();	
 	// now do the allocation
-	coremap[kicked_ass_page].addrspace = curthread->t_vmspace;
+	coremap_claim(kicked_ass_page);
+	coremap[kicked_ass_page].addrspace = NULL; // belongs to no process
 	coremap[kicked_ass_page].state = FIXED; // keep kernel pages in memory
 	coremap[kicked_ass_page].mapped_vaddr = PADDR_TO_KVADDR(coremap[kicked_ass_page].frame_start);
 	coremap[kicked_ass_page].num_pages_allocated = 1;
 	return (coremap[kicked_ass_page].mapped_vaddr);
 }
 /*
-	Allocate npages.
+	Allocate npages. Free runs come from the buddy allocator; only if
+	there's no big enough free block do we evict user pages to make one.
 */
 vaddr_t alloc_npages(int npages) {
 	assert(curspl > 0);
-	int num_continous = 1;
-	int i = 0; 
-	// find if there're npages in succession
-	for (; i < num_frames - 1; i++){
-		// as long as we've got enough, we break:)
-		if (num_continous >= npages) break;
-		if ((coremap[i].state == FREE) && (coremap[i + 1].state == FREE)) {
-			num_continous++;
-		} else {
-			num_continous = 1;
-		}
+	int i, j;
+	int start = coremap_claim_run(npages);
+	if (start < 0 && thread_cache_reclaim() > 0) {
+		// cached thread stacks are cheaper to give up than user pages
+		start = coremap_claim_run(npages);
 	}
-	// start is the first page allocated
-	int start = i - npages + 1;
-	if (num_continous >= npages) {
-		// found n continous free pages, just do the allocation
-		int j = start;
-		for (; j < npages + start; j++){
-			coremap[j].addrspace = curthread->t_vmspace;
-			coremap[j].state = FIXED;
-			coremap[j].mapped_vaddr = PADDR_TO_KVADDR(coremap[j].frame_start);
-			// redundancy not a problem ;)
-			coremap[j].num_pages_allocated = npages; 
-		}
-		assert(coremap[start].mapped_vaddr == PADDR_TO_KVADDR(coremap[start].frame_start));
-		return PADDR_TO_KVADDR(coremap[start].frame_start);
-
-	} else {
-		int found = 0;
+	if (start < 0) {
+		// find npages in succession that aren't kernel pages
 		int continous = 0;
-		for (i = 0; i < num_frames; i++) {
-			if (continous >= npages) {
-				found = 1;
-				break;
-			}
+		for (i = 0; i < num_frames && continous < npages; i++) {
 			if(coremap[i].state == FIXED) {
 				continous = 0;
-				continue;
 			} else {
 				continous ++;
 			}
 		}
-		if(!found) {
-			return NULL;
-		}
-		int starting_frame = i - npages + 1;
-		// sanity check
-		int j = starting_frame;
-		for (; j < starting_frame + npages; j++) {
-			if (coremap[j].state == FIXED) 
-				panic("alloc_npages contains a fixed page"); 
+		if (continous < npages) {
+			return 0;
 		}
+		start = i - npages;
 		// evict/swap all pages to disk
-		evict_or_swap_multiple(starting_frame, npages);
+		evict_or_swap_multiple(start, npages);
 		// sanity check: these npages shall now be free or clean
-		for (i = starting_frame; i < npages + starting_frame; i++) {
-			if (coremap[i].state != CLEAN || coremap[i].state != FREE) 
+		for (j = start; j < npages + start; j++) {
+			if (coremap[j].state != CLEAN && !FRAME_IS_FREE(coremap[j])) 
 				panic("alloc_npages after evict/swap contains a non-free page"); 
+			coremap_claim(j);
 		}
-		// allocation
-		for (i = starting_frame; i < npages + starting_frame; i++) {
-			coremap[i].addrspace = curthread->t_vmspace;
-			coremap[i].state = FIXED;
-			coremap[i].mapped_vaddr = PADDR_TO_KVADDR(coremap[i].frame_start);
-			coremap[i].num_pages_allocated = npages; 
-		}
-		return PADDR_TO_KVADDR(coremap[starting_frame].frame_start);
 	}
+	// allocation
+	for (j = start; j < npages + start; j++) {
+		coremap[j].addrspace = NULL;
+		coremap[j].state = FIXED;
+		coremap[j].mapped_vaddr = PADDR_TO_KVADDR(coremap[j].frame_start);
+		// redundancy not a problem ;)
+		coremap[j].num_pages_allocated = npages; 
+	}
+	return PADDR_TO_KVADDR(coremap[start].frame_start);
 }
 
 
@@ -465,11 +491,38 @@ alloc_kpages(int npages)
 	}
 }
 
+/*
+	Coremap index of the kernel page at KVADDR (which must be page
+	aligned), or -1 if that page isn't in the coremap.
+*/
+static
+int
+coremap_kindex(vaddr_t kvaddr)
+{
+	paddr_t paddr;
+	size_t index;
+
+	if (!vm_bootstraped || kvaddr < MIPS_KSEG0 || kvaddr >= MIPS_KSEG1) {
+		return -1;
+	}
+	paddr = kvaddr - MIPS_KSEG0;
+	if (paddr < coremap[0].frame_start) {
+		return -1;
+	}
+	index = (paddr - coremap[0].frame_start) / PAGE_SIZE;
+	if (index >= num_frames) {
+		return -1;
+	}
+	assert(coremap[index].frame_start == paddr);
+	return index;
+}
+
 /*
 	Function to free a certain number of pages given *ONLY* the starting address of the page.
 	*** The given address shall be page aligned ***
 	To know the number of pages to free here, we need to store information in the page structure
 	when we do the page allocation accordingly.
+	The coremap is in physical address order, so the page is found directly.
 */
 
 void 
@@ -479,24 +532,29 @@ free_kpages(vaddr_t addr)
 	assert(addr % PAGE_SIZE == 0);
 
 	int spl = splhigh();
-	int i = 0;
-	for (i = 0; i < num_frames; i++) {
-		if (PADDR_TO_KVADDR(coremap[i].frame_start) == addr) {
-			// found the starting page
-			int numpage_to_free = coremap[i].num_pages_allocated;
-			int j;
-			for (j = 0; j < numpage_to_free; j++) {
-				coremap[j + i].mapped_vaddr = 0xDEADBEEF;
-				coremap[j + i].state = FREE;
-				coremap[j + i].num_pages_allocated = 0;
-			}
-			splx(spl);
-			return;
-		}
+	int i = coremap_kindex(addr);
+	if (i < 0) {
+		// not found 
+		splx(spl);
+		panic("invalid addr to free_kpages");
+	}
+	int numpage_to_free = coremap[i].num_pages_allocated;
+	int j;
+	for (j = 0; j < numpage_to_free; j++) {
+		coremap_setfree(j + i);
 	}
-	// not found 
 	splx(spl);
-	panic("invalid addr to free_kpages");
+}
+
+struct pageref **
+kpage_pagerefp(vaddr_t kvaddr)
+{
+	int i = coremap_kindex(kvaddr & PAGE_FRAME);
+
+	if (i < 0) {
+		return NULL;
+	}
+	return &coremap[i].pageref;
 }
 
 /*
@@ -537,6 +595,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EINVAL;
 	}
 
+	curthread->t_rusage.ru_nfaults++;
+
 	as = curthread->t_vmspace;
 
 	if (as == NULL) {
@@ -656,7 +716,7 @@ int handle_vaddr_fault(vaddr_t faultaddress, unsigned int permissions) {
 	} else {
 		/************************************* 2nd Level Pagetable DNE ***************************************/
 		// If second page table doesn't exist, create one --> demand paging part
-		curthread->t_vmspace->as_master_pagetable[level1_index] = kmalloc(sizeof(struct as_pagetable));
+		curthread->t_vmspace->as_master_pagetable[level1_index] = kmem_cache_alloc(&as_pagetable_cache);
 		level2_pagetable = curthread->t_vmspace->as_master_pagetable[level1_index];
 		assert(level2_pagetable != NULL);
 		// initialize all PTE to 0, in order to unset both the PRESENT and SWAPPED bits 
@@ -773,20 +833,13 @@ paddr_t fetch_page(struct addrspace* as, vaddr_t va){
 	assert(pte != NULL);
 	assert((*pte & PTE_SWAPPED) != 0);
 	// find a free frame and load it back
-	int i = 0, found = 0;
-	for (; i < num_frames; i++) {
-		if (coremap[i].state == FREE){
-			found = 1;
-			load_page(as, va, i);
-			return coremap[i].frame_start;
-		}
-	}
-	// no free frame found, make one :)
-	if(!found) {
-		int free_frame = evict_or_swap();
-		load_page(as, va, free_frame);
-		return coremap[free_frame].frame_start;
+	int free_frame = find_free_frame();
+	if (free_frame == -1) {
+		// no free frame found, make one :)
+		free_frame = evict_or_swap();
 	}
+	load_page(as, va, free_frame);
+	return coremap[free_frame].frame_start;
 }
 
 
@@ -815,6 +868,7 @@ void load_page(struct addrspace* addrspace, vaddr_t vaddr, int frame_id) {
 		panic("load page from disk failed");
 	}
 	// update coremap entry
+	coremap_claim(frame_id);
 	coremap[frame_id].addrspace = addrspace;
 	coremap[frame_id].mapped_vaddr = vaddr;
 	coremap[frame_id].state = DIRTY; // not really, but safety first
@@ -858,18 +912,49 @@ void background_paging(void * args, unsigned int argc) {
 }
 
 
+/*
+	Find a free frame without evicting anything, preferring a plain
+	FREE one so the ZEROED ones are left for faults on fresh pages.
+	It's the first frame of the smallest free buddy block that starts
+	with a FREE frame, so single pages don't break up the big blocks
+	that multi-page kernel allocations need; failing that, the most
+	recently freed FREE frame. Only if no frame is FREE is a ZEROED one
+	used, again from the smallest block.
+	The frame stays free; whoever uses it calls coremap_claim.
+	@return the frame id, or -1 if there is none
+*/
+static int find_free_frame() {
+	assert(curspl > 0);
+
+	int order;
+	if (free_plain.count > 0) {
+		for (order = 0; order < BUDDY_NORDERS; order++) {
+			int head = buddy_free[order];
+			if (head >= 0 && coremap[head].state == FREE) {
+				return head;
+			}
+		}
+		return free_plain.head;
+	}
+	for (order = 0; order < BUDDY_NORDERS; order++) {
+		if (buddy_free[order] >= 0) {
+			return buddy_free[order];
+		}
+	}
+	return -1;
+}
+
 /*
 	Function that finds a free/clean frame, evict/swap if necessary
 */
 int get_free_frame() {
 		assert(curspl > 0);
 
-	int i = 0, free_frame = -1;
-	for (; i < num_frames; i++) {
-		if (coremap[i].state == FREE){
-			free_frame = i;
-			break;
-		}
+	int free_frame = find_free_frame();
+
+	if(free_frame == -1 && thread_cache_reclaim() > 0){
+		// cached thread stacks are cheaper to give up than user pages
+		free_frame = find_free_frame();
 	}
 
 	if(free_frame == -1){
@@ -881,13 +966,7 @@ int get_free_frame() {
 int get_free_frame_kernel() {
 	assert(curspl > 0);
 
-	int i = 0, free_frame = -1;
-	for (; i < num_frames; i++) {
-		if (coremap[i].state == FREE){
-			free_frame = i;
-			break;
-		}
-	}
+	int free_frame = find_free_frame();
 
 	if(free_frame == -1){
 		free_frame = evict_or_swap_kernel();
@@ -895,7 +974,352 @@ int get_free_frame_kernel() {
 	return free_frame;
 }
 
+/*
+	Function that finds a frame for a fresh user page and makes sure it
+	is full of zeros. Takes a frame the idle loop has already zeroed if
+	there is one; otherwise it zeroes one here.
+*/
+int get_zeroed_frame() {
+	assert(curspl > 0);
+
+	// look at the smallest free blocks first, as find_free_frame does
+	int order;
+	if (free_zeroed.count > 0) {
+		zero_hits++;
+		for (order = 0; order < BUDDY_NORDERS; order++) {
+			int head = buddy_free[order];
+			if (head >= 0 && coremap[head].state == ZEROED) {
+				return head;
+			}
+		}
+		return free_zeroed.head;
+	}
+
+	int free_frame = get_free_frame();
+	assert(coremap[free_frame].state == FREE || coremap[free_frame].state == CLEAN);
+	as_zero_page(coremap[free_frame].frame_start, 1);
+	zero_misses++;
+	return free_frame;
+}
+
+/*
+	Lists of free frames by state. Every free frame the buddy
+	allocator has is on free_plain if it's FREE or free_zeroed if it's
+	ZEROED; new ones go on the front. Interrupts must be off.
+*/
+static struct frame_list *frame_list_of(int frame_id) {
+	return coremap[frame_id].state == ZEROED ? &free_zeroed : &free_plain;
+}
+
+static void frame_list_insert(int frame_id) {
+	struct frame_list *fl = frame_list_of(frame_id);
+
+	assert(FRAME_IS_FREE(coremap[frame_id]));
+	coremap[frame_id].free_prev = -1;
+	coremap[frame_id].free_next = fl->head;
+	if (fl->head >= 0) {
+		coremap[fl->head].free_prev = frame_id;
+	}
+	else {
+		fl->tail = frame_id;
+	}
+	fl->head = frame_id;
+	fl->count++;
+}
+
+static void frame_list_remove(int frame_id) {
+	struct frame_list *fl = frame_list_of(frame_id);
+	int next = coremap[frame_id].free_next;
+	int prev = coremap[frame_id].free_prev;
+
+	if (prev >= 0) {
+		coremap[prev].free_next = next;
+	}
+	else {
+		assert(fl->head == frame_id);
+		fl->head = next;
+	}
+	if (next >= 0) {
+		coremap[next].free_prev = prev;
+	}
+	else {
+		assert(fl->tail == frame_id);
+		fl->tail = prev;
+	}
+	coremap[frame_id].free_next = coremap[frame_id].free_prev = -1;
+	fl->count--;
+}
+
+/*
+	Buddy allocator. Every free (FREE or ZEROED) frame from buddy_base on
+	is in exactly one free block of 2^order frames, whose offset from
+	buddy_base is a multiple of its size. The block is on the list
+	buddy_free[order], linked through the coremap entry of its first
+	frame, which also records the order; every other frame has
+	buddy_order -1. Interrupts must be off for all of these.
+*/
+static void buddy_insert(int frame_id, int order) {
+	coremap[frame_id].buddy_order = order;
+	coremap[frame_id].buddy_prev = -1;
+	coremap[frame_id].buddy_next = buddy_free[order];
+	if (buddy_free[order] >= 0) {
+		coremap[buddy_free[order]].buddy_prev = frame_id;
+	}
+	buddy_free[order] = frame_id;
+	buddy_nfree[order]++;
+}
+
+static void buddy_remove(int frame_id) {
+	int order = coremap[frame_id].buddy_order;
+	int next = coremap[frame_id].buddy_next;
+	int prev = coremap[frame_id].buddy_prev;
+
+	assert(order >= 0 && order < BUDDY_NORDERS);
+	if (prev >= 0) {
+		coremap[prev].buddy_next = next;
+	} else {
+		buddy_free[order] = next;
+	}
+	if (next >= 0) {
+		coremap[next].buddy_prev = prev;
+	}
+	coremap[frame_id].buddy_order = -1;
+	coremap[frame_id].buddy_next = coremap[frame_id].buddy_prev = -1;
+	buddy_nfree[order]--;
+}
+
+/*
+	Give a frame back, merging it with its buddy for as long as the
+	buddy is a whole free block of the same size.
+*/
+static void buddy_put(int frame_id) {
+	int order = 0;
+
+	assert(frame_id >= buddy_base && frame_id < num_frames);
+	assert(coremap[frame_id].buddy_order == -1);
+
+	for (; order < BUDDY_NORDERS - 1; order++) {
+		int buddy = buddy_base + ((frame_id - buddy_base) ^ (1 << order));
+		if (buddy + (1 << order) > num_frames
+		    || coremap[buddy].buddy_order != order) {
+			break;
+		}
+		buddy_remove(buddy);
+		if (buddy < frame_id) {
+			frame_id = buddy;
+		}
+	}
+	buddy_insert(frame_id, order);
+}
+
+/*
+	Take one particular free frame out of the buddy allocator: find the
+	block it's in and split that down, giving back the halves it isn't
+	in.
+*/
+static void buddy_take(int frame_id) {
+	int order = 0, head = -1;
+
+	assert(frame_id >= buddy_base && frame_id < num_frames);
+
+	for (; order < BUDDY_NORDERS; order++) {
+		head = buddy_base + ((frame_id - buddy_base) & ~((1 << order) - 1));
+		if (coremap[head].buddy_order == order) {
+			break;
+		}
+	}
+	if (order == BUDDY_NORDERS) {
+		panic("buddy_take: frame %d is not free\n", frame_id);
+	}
+	buddy_remove(head);
+
+	while (order > 0) {
+		order--;
+		int half = head + (1 << order);
+		if (frame_id < half) {
+			buddy_insert(half, order);
+		} else {
+			buddy_insert(head, order);
+			head = half;
+		}
+	}
+	assert(head == frame_id);
+}
+
+/*
+	Take NPAGES contiguous free frames out of the buddy allocator.
+	Splits the smallest block that's big enough; frames past NPAGES
+	in the power-of-two block go straight back.
+	@return the first frame id, or -1 if there's no big enough block
+*/
+static int buddy_alloc(int npages) {
+	int order = 0, k, head, j;
+
+	assert(npages > 0);
+	while ((1 << order) < npages) {
+		order++;
+		if (order == BUDDY_NORDERS) {
+			return -1;
+		}
+	}
+	for (k = order; k < BUDDY_NORDERS && buddy_free[k] < 0; k++);
+	if (k == BUDDY_NORDERS) {
+		return -1;
+	}
+
+	head = buddy_free[k];
+	buddy_remove(head);
+	while (k > order) {
+		k--;
+		buddy_insert(head + (1 << k), k);
+	}
+	for (j = npages; j < (1 << order); j++) {
+		buddy_put(head + j);
+	}
+	return head;
+}
+
+/*
+	Called on a frame that's about to be used for something, before
+	its state is changed. If it was free, it comes out of the buddy
+	allocator.
+*/
+static void coremap_claim(int frame_id) {
+	assert(curspl > 0);
+
+	if (FRAME_IS_FREE(coremap[frame_id])) {
+		buddy_take(frame_id);
+		frame_list_remove(frame_id);
+	}
+}
 
+/*
+	Take NPAGES contiguous free frames for a kernel allocation; the
+	caller sets their state.
+	@return the first frame id, or -1 if there's no big enough block
+*/
+static int coremap_claim_run(int npages) {
+	assert(curspl > 0);
+
+	int start = buddy_alloc(npages);
+	int j;
+	for (j = 0; start >= 0 && j < npages; j++) {
+		frame_list_remove(start + j);
+	}
+	return start;
+}
+
+/*
+	Mark a frame free. Everything that gives a frame back goes through
+	here so the idle loop knows there is zeroing to do.
+*/
+void coremap_setfree(int frame_id) {
+	assert(curspl > 0);
+	assert(!FRAME_IS_FREE(coremap[frame_id]));
+
+	coremap[frame_id].addrspace = NULL;
+	coremap[frame_id].mapped_vaddr = 0xDEADBEEF;
+	coremap[frame_id].state = FREE;
+	coremap[frame_id].num_pages_allocated = 0;
+	coremap[frame_id].pageref = NULL;
+	if (frame_id >= buddy_base) {
+		buddy_put(frame_id);
+		frame_list_insert(frame_id);
+	}
+}
+
+/*
+	Zero one FREE frame and mark it ZEROED. Called from the idle loop
+	with interrupts off, one frame at a time so interrupts can get in
+	between. It takes the frame that has been free longest: that one
+	has had the most chance to merge into a big block, which
+	find_free_frame tries not to break up anyway, while recently freed
+	frames are left FREE for it to hand out.
+	@return nonzero if a frame was zeroed, 0 if there was nothing to do
+*/
+int vm_zero_idle() {
+	assert(curspl > 0);
+
+	if (!vm_bootstraped || free_plain.count == 0) {
+		return 0;
+	}
+
+	int i = free_plain.tail;
+	frame_list_remove(i);
+	as_zero_page(coremap[i].frame_start, 1);
+	coremap[i].state = ZEROED;
+	frame_list_insert(i);
+	zero_idle++;
+	return 1;
+}
+
+/*
+	Print how many frames are in each state, and how the pre-zeroing
+	is doing.
+*/
+void vm_printstats() {
+	int spl = splhigh();
+	int counts[ZEROED + 1];
+	int i = 0;
+
+	bzero(counts, sizeof(counts));
+	for (; i < num_frames; i++) {
+		counts[coremap[i].state]++;
+	}
+	kprintf("frames: %d free, %d zeroed, %d fixed, %d dirty, %d clean\n",
+		counts[FREE], counts[ZEROED], counts[FIXED], counts[DIRTY],
+		counts[CLEAN]);
+	kprintf("free blocks by size (frames):");
+	for (i = 0; i < BUDDY_NORDERS; i++) {
+		kprintf(" %d:%d", 1 << i, buddy_nfree[i]);
+	}
+	kprintf("\n");
+	kprintf("fresh page faults: %lu pre-zeroed, %lu zeroed on demand; "
+		"%lu frames zeroed while idle\n",
+		(unsigned long) zero_hits, (unsigned long) zero_misses,
+		(unsigned long) zero_idle);
+	splx(spl);
+}
+
+
+
+/*
+	Free frame counts for kheap_getstats: how many frames are free, the
+	longest run of them, and the biggest buddy block (which can be
+	smaller than the longest run, since blocks must be aligned).
+*/
+void vm_getfragstats(struct kheapstats *ks) {
+	int spl = splhigh();
+	u_int32_t run = 0;
+	int i = 0;
+
+	ks->khs_frames = ks->khs_freeframes = 0;
+	ks->khs_largestrun = ks->khs_largestblock = 0;
+	if (!vm_bootstraped) {
+		splx(spl);
+		return;
+	}
+
+	ks->khs_frames = num_frames - buddy_base;
+	for (i = buddy_base; i < num_frames; i++) {
+		if (FRAME_IS_FREE(coremap[i])) {
+			ks->khs_freeframes++;
+			run++;
+			if (run > ks->khs_largestrun) {
+				ks->khs_largestrun = run;
+			}
+		} else {
+			run = 0;
+		}
+	}
+	for (i = BUDDY_NORDERS - 1; i >= 0; i--) {
+		if (buddy_free[i] >= 0) {
+			ks->khs_largestblock = 1 << i;
+			break;
+		}
+	}
+	splx(spl);
+}
 
 /* 
 	Function that loads a specified page from swapfile, evict/swap if necessary.
@@ -906,7 +1330,7 @@ paddr_t load_swapped_page(struct addrspace* as, vaddr_t va){
 		assert(curspl > 0);
 
 	int free_frame = get_free_frame();
-	assert(coremap[free_frame].state == CLEAN || coremap[free_frame].state == FREE);
+	assert(coremap[free_frame].state == CLEAN || FRAME_IS_FREE(coremap[free_frame]));
 	// load the page into this frame
 	load_page(as, va, free_frame);
 	assert(coremap[free_frame].state == DIRTY);
@@ -39,3 +39,18 @@ gettime(time_t *secs, u_int32_t *nsecs)
 	assert(the_clock!=NULL);
 	the_clock->rtc_gettime(the_clock->rtc_devdata, secs, nsecs);
 }
+
+/*
+ * Like gettime, but for code that may run before the clock has been
+ * attached: returns zero then instead of panicking.
+ */
+void
+gettime_early(time_t *secs, u_int32_t *nsecs)
+{
+	if (the_clock==NULL) {
+		*secs = 0;
+		*nsecs = 0;
+		return;
+	}
+	the_clock->rtc_gettime(the_clock->rtc_devdata, secs, nsecs);
+}
@@ -22,6 +22,24 @@
 
 static int haveclock=0;
 
+/*
+ * Change the hardclock timer to go off every TICKS hardclock ticks
+ * instead of every one. Used by hardclock for tickless idle. Writing
+ * the count register restarts the countdown.
+ */
+static
+void
+ltimer_setticks(void *vlt, int ticks)
+{
+	struct ltimer_softc *lt = vlt;
+
+	assert(lt->lt_hardclock);
+	assert(ticks > 0);
+
+	bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
+			   ticks * (LT_GRANULARITY/HZ));
+}
+
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -45,6 +63,7 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
 		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
 				   LT_GRANULARITY/HZ);
+		hardclock_register_timer(ltimer_setticks, lt);
 
 		kprintf("\nhardclock on ltimer%d (%u hz)", ltimerno, HZ);
 	}
@@ -14,12 +14,17 @@
 #include <uio.h>
 #include <dev.h>
 #include <sfs.h>
+#include <kmem_cache.h>
 
 /* At bottom of file */
 static int 
 sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int type,
 		 struct sfs_vnode **ret);
 
+/* In-core vnodes, for all mounted SFS volumes. */
+static struct kmem_cache sfs_vnode_cache =
+	KMEM_CACHE_INIT("sfs_vnode", sizeof(struct sfs_vnode), NULL, NULL);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -864,8 +869,10 @@ sfs_reclaim(struct vnode *v)
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
 	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * this with sfs_loadvnode.) Holding sfs_vnlock for writing keeps
+	 * sfs_loadvnode from finding it again until it's gone.
 	 */
+	rwlock_acquire_write(sfs->sfs_vnlock);
 	lock_acquire(v->vn_countlock);
 	if (v->vn_refcount != 1) {
 
@@ -874,6 +881,7 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		lock_release(v->vn_countlock);
+		rwlock_release_write(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 	lock_release(v->vn_countlock);
@@ -883,6 +891,7 @@ sfs_reclaim(struct vnode *v)
 	if (sv->sv_i.sfi_linkcount==0) {
 		result = VOP_TRUNCATE(&sv->sv_v, 0);
 		if (result) {
+			rwlock_release_write(sfs->sfs_vnlock);
 			return result;
 		}
 	}
@@ -890,6 +899,7 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
+		rwlock_release_write(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -913,11 +923,12 @@ sfs_reclaim(struct vnode *v)
 		      sv->sv_ino);
 	}
 	array_remove(sfs->sfs_vnodes, ix);
+	rwlock_release_write(sfs->sfs_vnlock);
 
 	VOP_KILL(&sv->sv_v);
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(&sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -1539,18 +1550,16 @@ static const struct vnode_ops sfs_dirops = {
 };
 
 /*
- * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * Look for inode INO in the vnodes table, and if it's there, hand it
+ * back with a new reference. Returns NULL if it isn't loaded. Must
+ * hold sfs_vnlock, for reading at least.
  */
 static
-int
-sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
-		 struct sfs_vnode **ret)
+struct sfs_vnode *
+sfs_findvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype)
 {
 	struct sfs_vnode *sv;
-	const struct vnode_ops *ops = NULL;
 	int i, num;
-	int result;
 
 	/* Look in the vnodes table */
 	num = array_getnum(sfs->sfs_vnodes);
@@ -1572,14 +1581,29 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 			assert(forcetype==SFS_TYPE_INVAL);
 
 			VOP_INCREF(&sv->sv_v);
-			*ret = sv;
-			return 0;
+			return sv;
 		}
 	}
 
-	/* Didn't have it loaded; load it */
+	return NULL;
+}
+
+/*
+ * Read inode INO in from disk and add it to the vnodes table. Must
+ * hold sfs_vnlock for writing.
+ */
+static
+int
+sfs_newvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
+	     struct sfs_vnode **ret)
+{
+	struct sfs_vnode *sv;
+	const struct vnode_ops *ops = NULL;
+	int result;
+
+	assert(rwlock_do_i_write(sfs->sfs_vnlock));
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(&sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1593,7 +1617,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1630,7 +1654,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1641,7 +1665,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	result = array_add(sfs->sfs_vnodes, sv);
 	if (result) {
 		VOP_KILL(&sv->sv_v);
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1650,6 +1674,47 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	return 0;
 }
 
+/*
+ * Function to load a inode into memory as a vnode, or dig up one
+ * that's already resident.
+ *
+ * Nearly every call finds the vnode already loaded, so the table is
+ * searched holding sfs_vnlock for reading, which doesn't hold up
+ * anyone else doing the same. Only if it isn't there do we come back
+ * for the write lock; someone else may have loaded it in between, so
+ * we have to look again before loading it ourselves.
+ */
+static
+int
+sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
+		 struct sfs_vnode **ret)
+{
+	struct sfs_vnode *sv;
+	int result = 0;
+
+	rwlock_acquire_read(sfs->sfs_vnlock);
+	sv = sfs_findvnode(sfs, ino, forcetype);
+	rwlock_release_read(sfs->sfs_vnlock);
+	if (sv != NULL) {
+		*ret = sv;
+		return 0;
+	}
+
+	/* Didn't have it loaded; load it */
+	rwlock_acquire_write(sfs->sfs_vnlock);
+	sv = sfs_findvnode(sfs, ino, forcetype);
+	if (sv == NULL) {
+		result = sfs_newvnode(sfs, ino, forcetype, &sv);
+	}
+	rwlock_release_write(sfs->sfs_vnlock);
+	if (result) {
+		return result;
+	}
+
+	*ret = sv;
+	return 0;
+}
+
 /*
  * Get vnode for the root of the filesystem.
  * The root vnode is always found in block 1 (SFS_ROOT_LOCATION).
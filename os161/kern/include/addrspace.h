@@ -22,6 +22,10 @@ struct as_pagetable{
 	u_int32_t PTE [SECOND_LEVEL_PT_SIZE];
 };
 
+/* Page tables are allocated from this (see kmem_cache.h). */
+struct kmem_cache;
+extern struct kmem_cache as_pagetable_cache;
+
 /*************************************** User address space *************************************/
 #define MAX_STACK_PAGES 24
 
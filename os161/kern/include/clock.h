@@ -8,6 +8,7 @@
  *
  * hardclock() is called from the timer interrupt HZ times a second.
  * gettime() may be used to fetch the current time of day.
+ * gettime_early() is the same, but returns 0 if there's no clock yet.
  * getinterval() computes the time from time1 to time2.
  */
 
@@ -22,7 +23,24 @@
 
 void hardclock(void);
 
+/*
+ * Tickless idle support.
+ *
+ * hardclock_idle() is called by the scheduler in place of cpu_idle()
+ * when there's nothing to run. If the timer driving hardclock has
+ * registered a function to change its tick interval (with
+ * hardclock_register_timer), the timer is told to stay quiet until
+ * the next tick hardclock actually needs, and the skipped ticks are
+ * accounted for on wakeup. Setting hardclock_tickless to 0 turns
+ * this off.
+ */
+extern int hardclock_tickless;
+void hardclock_idle(void);
+void hardclock_register_timer(void (*setticks)(void *devdata, int ticks),
+			      void *devdata);
+
 void gettime(time_t *seconds, u_int32_t *nanoseconds);
+void gettime_early(time_t *seconds, u_int32_t *nanoseconds);
 
 void getinterval(time_t secs1, u_int32_t nsecs,
 		 time_t secs2, u_int32_t nsecs2,
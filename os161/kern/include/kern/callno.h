@@ -40,6 +40,10 @@
 #define SYS___getcwd     29
 #define SYS_stat         30
 #define SYS_lstat        31
+#define SYS_nanosleep    32
+#define SYS_getrusage    33
+#define SYS_setshare     34
+#define SYS_kheapstats   35
 /*CALLEND*/
 
 
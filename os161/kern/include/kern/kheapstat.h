@@ -0,0 +1,46 @@
+#ifndef _KERN_KHEAPSTAT_H_
+#define _KERN_KHEAPSTAT_H_
+
+/*
+ * Structure for kheapstats (call to get kernel heap and physical
+ * memory fragmentation statistics).
+ *
+ * Blocks of up to 2048 bytes come from pages split into blocks of one
+ * size (the size classes); anything bigger gets whole pages. The
+ * counts marked "total" run from boot and wrap around, so a soak test
+ * should take the difference between two samples.
+ *
+ * Request sizes are also counted in a histogram: bucket 0 is requests
+ * of up to KHS_HISTMIN bytes, and each bucket after that is for sizes
+ * up to twice as big as the one before; the last one is for
+ * everything bigger than that.
+ */
+
+#define KHS_NCLASSES	8	/* subpage size classes */
+#define KHS_NHIST	13	/* request size histogram buckets */
+#define KHS_HISTMIN	16	/* biggest size in histogram bucket 0 */
+
+struct kheapstats {
+	/* subpage allocator, per size class */
+	u_int32_t khs_size[KHS_NCLASSES];	/* block size */
+	u_int32_t khs_pages[KHS_NCLASSES];	/* pages split into blocks */
+	u_int32_t khs_partial[KHS_NCLASSES];	/* of those, with blocks free */
+	u_int32_t khs_inuse[KHS_NCLASSES];	/* blocks handed out */
+	u_int32_t khs_nalloc[KHS_NCLASSES];	/* total allocations */
+	u_int32_t khs_reqbytes[KHS_NCLASSES];	/* total bytes asked for */
+
+	/* whole-page allocations */
+	u_int32_t khs_bignalloc;		/* total allocations */
+	u_int32_t khs_bigreqbytes;		/* total bytes asked for */
+	u_int32_t khs_bigpages;			/* total pages handed out */
+
+	u_int32_t khs_hist[KHS_NHIST];		/* request sizes */
+
+	/* physical page frames */
+	u_int32_t khs_frames;			/* frames the VM system manages */
+	u_int32_t khs_freeframes;		/* of those, free */
+	u_int32_t khs_largestrun;		/* most contiguous free frames */
+	u_int32_t khs_largestblock;		/* largest free buddy block */
+};
+
+#endif /* _KERN_KHEAPSTAT_H_ */
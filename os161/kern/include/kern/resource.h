@@ -0,0 +1,24 @@
+#ifndef _KERN_RESOURCE_H_
+#define _KERN_RESOURCE_H_
+
+/*
+ * Structure for getrusage (call to get CPU and scheduling statistics
+ * for a process).
+ *
+ * Times are seconds plus microseconds. "Wait" time is time spent
+ * runnable but waiting for the processor; time spent asleep is not
+ * counted anywhere.
+ */
+
+struct rusage {
+	time_t ru_runsecs;	/* time on the processor */
+	u_int32_t ru_runusecs;
+	time_t ru_waitsecs;	/* time on a run queue */
+	u_int32_t ru_waitusecs;
+	u_int32_t ru_ticks;	/* hardclock ticks taken while running */
+	u_int32_t ru_nvcsw;	/* voluntary context switches */
+	u_int32_t ru_nivcsw;	/* involuntary context switches */
+	u_int32_t ru_nfaults;	/* VM faults */
+};
+
+#endif /* _KERN_RESOURCE_H_ */
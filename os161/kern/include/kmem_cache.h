@@ -0,0 +1,83 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A kmem_cache hands out fixed-size objects of one kind, and keeps the
+ * ones that are freed for the next allocation instead of giving them
+ * straight back to kmalloc. Objects are kept constructed: the
+ * constructor runs only when an object is first made, and the
+ * destructor only when it finally goes back to kfree. Whatever state
+ * the constructor sets up (a semaphore the object owns, say) is there
+ * for free on every reuse, so the caller must put it back the way the
+ * constructor left it before freeing the object.
+ *
+ *     KMEM_CACHE_INIT   - static initializer, for caches that live as
+ *                         long as the kernel. They need no setup call and
+ *                         work as soon as kmalloc does.
+ *     kmem_cache_create - make a cache named NAME for objects of SIZE
+ *                         bytes. CTOR (which returns an error code) and
+ *                         DTOR may be NULL. Returns NULL if out of memory.
+ *     kmem_cache_destroy - free everything CACHE is keeping and CACHE
+ *                         itself, once no kmem_cache_reap is working on
+ *                         it. Objects still in use are the caller's
+ *                         problem; only for caches from kmem_cache_create.
+ *
+ *     kmem_cache_alloc  - get an object; NULL if out of memory or the
+ *                         constructor failed.
+ *     kmem_cache_free   - give one back. Safe with interrupts in any
+ *                         state, as long as the destructor is.
+ *
+ *     kmem_cache_reap   - free every kept object in every cache. kmalloc
+ *                         calls it when it runs out. Returns how many
+ *                         objects it freed.
+ *     kmem_cache_printstats - print statistics for every cache.
+ *
+ * Each cache keeps at most KMEM_CACHE_NFREE objects, and fewer for big
+ * objects, so the most memory sitting idle in one cache is about
+ * KMEM_CACHE_MAXIDLE bytes.
+ */
+
+#define KMEM_CACHE_NFREE	16
+#define KMEM_CACHE_MAXIDLE	16384
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* object size */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	struct kmem_cache *kc_next;	/* list of all caches */
+	int kc_listed;			/* nonzero once on the list */
+	int kc_reaping;			/* kmem_cache_reaps working on it */
+	int kc_dynamic;			/* from kmem_cache_create */
+	int kc_maxfree;			/* most objects to keep */
+	int kc_nfree;			/* objects kept now */
+	void *kc_free[KMEM_CACHE_NFREE];
+
+	/* statistics */
+	int kc_inuse;			/* objects handed out now */
+	int kc_maxinuse;		/* most ever handed out at once */
+	u_int32_t kc_nalloc;		/* successful kmem_cache_allocs */
+	u_int32_t kc_nhit;		/* of those, served from kc_free */
+	u_int32_t kc_nctor;		/* objects constructed */
+	u_int32_t kc_ndtor;		/* objects destroyed */
+};
+
+#define KMEM_CACHE_INIT(name, size, ctor, dtor) \
+	{ name, size, ctor, dtor, NULL, 0, 0, 0, 0, 0, { NULL }, \
+	  0, 0, 0, 0, 0, 0 }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *cache);
+
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+int kmem_cache_reap(void);
+void kmem_cache_printstats(void);
+
+#endif /* _KMEM_CACHE_H_ */
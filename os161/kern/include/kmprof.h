@@ -0,0 +1,72 @@
+#ifndef _KMPROF_H_
+#define _KMPROF_H_
+
+#include "opt-kmprof.h"
+
+/*
+ * Kernel heap call-site profiler ("kmprof").
+ *
+ * With the kmprof kernel option, kmalloc records the return address
+ * of its caller (the "site") with every allocation, and kfree finds
+ * it again, so each site has a count of the bytes and blocks it has
+ * live right now and the allocations it has made in total. Sites are
+ * printed as addresses; look them up in the kernel image with nm or
+ * addr2line.
+ *
+ *     kmprof_print    - print the N sites with the most live bytes.
+ *     kmprof_snapshot - remember every site's counts as they are now.
+ *     kmprof_diff     - print the N sites whose live bytes grew most
+ *                       since the snapshot: leaks show up here.
+ *
+ * The rest is called by the allocator and things built on it:
+ *
+ *     KMPROF_CALLER   - the current function's return address, to pass
+ *                       on as the site.
+ *     kmprof_alloc    - kmalloc gave out PTR, of SZ bytes, for SITE.
+ *     kmprof_free     - PTR is about to be freed.
+ *     kmprof_retag    - PTR, already allocated, has been handed out
+ *                       again to SITE (an object cache hit). Its live
+ *                       bytes move to SITE, which is charged one more
+ *                       allocation.
+ *
+ * Wrappers around kmalloc (kstrdup, kmem_cache_alloc) pass their own
+ * caller on with kmalloc_from, so what they allocate is charged to
+ * whoever called them. Objects kept in an object cache after being
+ * freed still count as live for the site that last had them.
+ *
+ * The tables are fixed size. Sites past the first KMPROF_NSITES are
+ * lumped together as site 0. A block allocated while KMPROF_NLIVE are
+ * already being tracked counts towards its site's allocations, but
+ * not its live bytes or blocks, since its kfree couldn't be matched
+ * up and it would look like a leak; both reports start with a warning
+ * saying how many such blocks there are.
+ *
+ * Without the option, KMPROF_CALLER is 0, the hooks compile to
+ * nothing, and there are no menu commands.
+ */
+
+#if OPT_KMPROF
+
+#define KMPROF_NSITES	256	/* call sites; must be a power of 2 */
+#define KMPROF_NLIVE	2048	/* live blocks tracked */
+
+#define KMPROF_CALLER()	((vaddr_t)__builtin_return_address(0))
+
+void kmprof_alloc(void *ptr, size_t sz, vaddr_t site);
+void kmprof_free(void *ptr);
+void kmprof_retag(void *ptr, vaddr_t site);
+
+void kmprof_print(int n);
+void kmprof_snapshot(void);
+void kmprof_diff(int n);
+
+#else
+
+#define KMPROF_CALLER()			((vaddr_t)0)
+#define kmprof_alloc(ptr, sz, site)	((void)(site))
+#define kmprof_free(ptr)
+#define kmprof_retag(ptr, site)		((void)(site))
+
+#endif /* OPT_KMPROF */
+
+#endif /* _KMPROF_H_ */
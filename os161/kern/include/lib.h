@@ -86,10 +86,23 @@ u_int32_t random(void);
 /*
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
+ *
+ * kheap_printstats prints how the heap is being used: per size class,
+ * request sizes, and physical memory fragmentation. kheap_getstats
+ * gets the same numbers (see kern/kheapstat.h). kheap_printpages
+ * prints a map of every page of small blocks.
+ *
+ * kmalloc_from is kmalloc for wrappers around it: SITE, normally the
+ * wrapper's KMPROF_CALLER(), is who gets charged for the block by the
+ * call-site profiler (see kmprof.h).
  */
+struct kheapstats;
 void *kmalloc(size_t sz);
+void *kmalloc_from(size_t sz, vaddr_t site);
 void kfree(void *ptr);
 void kheap_printstats(void);
+void kheap_getstats(struct kheapstats *ks);
+void kheap_printpages(void);
 
 /*
  * C string functions. 
@@ -0,0 +1,71 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+#include "opt-lockstat.h"
+
+/*
+ * Lock contention statistics ("lockstat").
+ *
+ * With the lockstat kernel option, every struct lock counts how often
+ * it was acquired, how often the acquirer had to wait for it, and how
+ * long locks were waited for and held (total and worst case), timed
+ * with the realtime clock. All live locks are kept on one list so the
+ * hot ones can be found:
+ *
+ *     lockstat_print - print the N locks with the most total wait.
+ *     lockstat_reset - zero the counts on every lock.
+ *
+ * The rest is called by the lock code:
+ *
+ *     lockstat_register   - LOCK has been created.
+ *     lockstat_unregister - LOCK is about to be destroyed.
+ *     lockstat_acquired   - LOCK has a new holder.
+ *     lockstat_released   - LOCK's holder has let go of it.
+ *     lockstat_now        - timestamp for the start of a wait.
+ *     lockstat_waited     - an acquirer of LOCK waited since START.
+ *
+ * Without the option, struct lock has no statistics, the hooks
+ * compile to nothing, and there are no menu commands.
+ */
+
+struct lock;
+
+#if OPT_LOCKSTAT
+
+struct lockstat {
+	struct lock *ls_next;		/* list of all locks */
+	struct lock **ls_prevp;
+	u_int32_t ls_stamp;		/* when the holder got it (usecs) */
+
+	u_int32_t ls_acquires;		/* times acquired */
+	u_int32_t ls_contended;		/* times an acquirer had to wait */
+	time_t ls_waitsecs;		/* total waiting time */
+	u_int32_t ls_waitusecs;
+	u_int32_t ls_maxwait;		/* longest wait (usecs) */
+	time_t ls_holdsecs;		/* total holding time */
+	u_int32_t ls_holdusecs;
+	u_int32_t ls_maxhold;		/* longest hold (usecs) */
+};
+
+void lockstat_register(struct lock *lock);
+void lockstat_unregister(struct lock *lock);
+void lockstat_acquired(struct lock *lock);
+void lockstat_released(struct lock *lock);
+u_int32_t lockstat_now(void);
+void lockstat_waited(struct lock *lock, u_int32_t start);
+
+void lockstat_print(int n);
+void lockstat_reset(void);
+
+#else
+
+#define lockstat_register(lock)
+#define lockstat_unregister(lock)
+#define lockstat_acquired(lock)
+#define lockstat_released(lock)
+#define lockstat_now()			0
+#define lockstat_waited(lock, start)	((void)(start))
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
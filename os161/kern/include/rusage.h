@@ -0,0 +1,45 @@
+#ifndef _RUSAGE_H_
+#define _RUSAGE_H_
+
+/*
+ * Thread and process CPU accounting.
+ *
+ * Each thread keeps a struct rusage (see kern/resource.h) and a
+ * timestamp of its last state change. The thread system calls these
+ * as threads move around:
+ *
+ *     rusage_stamp      - T has just gone onto a run queue.
+ *     rusage_chargerun  - T is coming off the processor; charge the
+ *                         time since its stamp as run time.
+ *     rusage_chargewait - T has just been picked to run; charge the
+ *                         time since its stamp as wait time. Returns
+ *                         the wait in microseconds, for schedlat.
+ *
+ * Everything else is for reading the numbers:
+ *
+ *     rusage_add        - add one struct rusage into another.
+ *     thread_getrusage  - get T's statistics, including its current
+ *                         run if T is curthread.
+ *     pcb_getrusage     - get the statistics for process PID: those
+ *                         of its thread while it lives, and what was
+ *                         saved in its PCB when it exited. Returns an
+ *                         error code.
+ *     rusage_printall   - print a table of every process, "ps" style.
+ *
+ * All of these are safe to call with interrupts in any state.
+ */
+
+#include <kern/resource.h>
+
+struct thread;
+
+void rusage_stamp(struct thread *t);
+void rusage_chargerun(struct thread *t);
+u_int32_t rusage_chargewait(struct thread *t);
+
+void rusage_add(struct rusage *to, const struct rusage *from);
+void thread_getrusage(struct thread *t, struct rusage *ru);
+int pcb_getrusage(int pid, struct rusage *ru);
+void rusage_printall(void);
+
+#endif /* _RUSAGE_H_ */
@@ -0,0 +1,34 @@
+#ifndef _SCHEDLAT_H_
+#define _SCHEDLAT_H_
+
+/*
+ * Scheduling latency histograms.
+ *
+ * Every time a thread is picked to run, the time it spent on the run
+ * queue (from make_runnable to being dispatched by mi_switch) goes
+ * into a log2 histogram of microseconds: bucket 0 counts waits under
+ * 2us, bucket i waits of 2^i to 2^(i+1)-1 us, and the last bucket
+ * everything longer.
+ *
+ * There's one histogram per thread and two global ones: all
+ * dispatches, and just the ones that followed a thread_wakeup (the
+ * wakeup-to-run latency).
+ *
+ *     schedlat_record  - record a dispatch of T after USECS of waiting.
+ *                        Called from mi_switch with interrupts off.
+ *     schedlat_print   - print the global histograms, or those of the
+ *                        thread of process PID if PID isn't 0.
+ *                        Returns an error code.
+ *     schedlat_reset   - zero the global histograms and those of every
+ *                        process.
+ */
+
+#define SCHEDLAT_NBUCKETS 21	/* up to ~1 second */
+
+struct thread;
+
+void schedlat_record(struct thread *t, u_int32_t usecs);
+int schedlat_print(int pid);
+void schedlat_reset(void);
+
+#endif /* _SCHEDLAT_H_ */
@@ -9,7 +9,31 @@
  *                     already on the run queue or sleeping, weird things
  *                     may happen. Returns an error code.
  *
+ *     scheduler_tick - charge a hardclock tick to the current thread.
+ *                     Returns nonzero if it should yield.
+ *     scheduler_boost - raise the priority of a thread that is waking
+ *                     up from sleep. Call before make_runnable.
+ *     scheduler_setpriority - set a thread's base priority level
+ *                     (0 .. SCHED_NLEVELS-1, 0 is highest); it never
+ *                     runs above its base level. Returns an error code.
+ *     scheduler_level - the level T is currently scheduled at: its own
+ *                     or the one it inherited, whichever is higher.
+ *     scheduler_setinherit - set the level T inherits from threads
+ *                     waiting on locks it holds (SCHED_NLEVELS for
+ *                     none). Interrupts must be off.
+ *     scheduler_preempted - nonzero if something of higher priority
+ *                     than curthread is runnable. Interrupts must be
+ *                     off.
+ *     scheduler_setshare - put a thread in the stride (proportional
+ *                     share) class with the given number of tickets
+ *                     (1 .. STRIDE_MAXTICKETS), or back in the MLFQ
+ *                     with 0 tickets. Returns an error code.
+ *     scheduler_setquantum - set the top-level time slice in hardclock
+ *                     ticks (1 .. HZ); each level down gets twice as
+ *                     long. Returns an error code.
+ *
  *     print_run_queue - dump the run queue to the console for debugging.
+ *     scheduler_printstats - print the length of each run queue.
  *
  *     scheduler_bootstrap - initialize scheduler data 
  *                           (must happen early in boot)
@@ -18,12 +42,32 @@
  *                           Returns an error code.
  */
 
+/* Number of priority levels (run queues) */
+#define SCHED_NLEVELS      4
+
+/* Hardclock ticks between aging passes (everything back to its base) */
+#define SCHED_AGING_TICKS  100
+
+/* Stride scheduling: pass units per tick at one ticket, ticket limit */
+#define STRIDE1            (1 << 20)
+#define STRIDE_MAXTICKETS  1000
+
 struct thread;
 
 struct thread *scheduler(void);
 int make_runnable(struct thread *t);
 
+int scheduler_tick(void);
+void scheduler_boost(struct thread *t);
+int scheduler_setpriority(struct thread *t, int level);
+int scheduler_setquantum(int ticks);
+int scheduler_setshare(struct thread *t, int tickets);
+int scheduler_level(struct thread *t);
+void scheduler_setinherit(struct thread *t, int level);
+int scheduler_preempted(void);
+
 void print_run_queue(void);
+void scheduler_printstats(void);
 
 void scheduler_bootstrap(void);
 int scheduler_preallocate(int numthreads);
@@ -8,6 +8,7 @@
 
 #include <thread.h>
 #include <array.h>
+#include <lockstat.h>
 
 /*
  * Dijkstra-style semaphore.
@@ -15,21 +16,36 @@
  *     P (proberen): decrement count. If the count is 0, block
  * 			until the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *     V_n: increment count by N at once.
+ *     P_try: decrement count if it's above 0; otherwise return EAGAIN
+ *          instead of blocking.
+ *     P_timeout: P, but if the count stays 0 for TICKS hardclock
+ *          ticks, give up and return ETIMEDOUT.
  * 
- * Both operations are atomic.
+ * These operations are atomic.
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * The semaphore counts the threads sleeping in P, and V wakes only as
+ * many of them as it adds to the count (oldest first). Setting
+ * sem_wakeone to 0 goes back to waking them all, for comparison.
  */
 
 struct semaphore {
 	char *name;
 	volatile int count;
+	volatile int waiters;	/* threads asleep in P */
 };
 
+extern int sem_wakeone;
+
 struct semaphore *sem_create(const char *name, int initial_count);
 void              P(struct semaphore *);
+int               P_try(struct semaphore *);
+int               P_timeout(struct semaphore *, int ticks);
 void              V(struct semaphore *);
+void              V_n(struct semaphore *, int n);
 void              sem_destroy(struct semaphore *);
 
 
@@ -42,6 +58,18 @@ void              sem_destroy(struct semaphore *);
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
+ *    lock_tryacquire - Get the lock if it's free and return 0; if not,
+ *                   return EAGAIN without waiting.
+ *    lock_acquire_timeout - Get the lock, but if it isn't ours within
+ *                   TICKS hardclock ticks, give up and return ETIMEDOUT.
+ *    lock_acquire_n - Get all N locks in an array (at most LOCK_MAXN).
+ *                   They are taken in a fixed global order, so callers
+ *                   can't deadlock against each other whatever order
+ *                   they list them in; if all are free they are simply
+ *                   all taken at once.
+ *    lock_release_n - Release all N locks in an array.
+ *    lock_acquire_two, lock_acquire_three, and the matching releases,
+ *                 - Shorthand for lock_acquire_n and lock_release_n.
  *
  * These operations must be atomic. You get to write them.
  *
@@ -50,6 +78,20 @@ void              sem_destroy(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * Locks do priority inheritance: while a thread waits for a lock, the
+ * holder (and whatever it in turn is waiting for, and so on) runs at
+ * the waiter's scheduling level if that's higher than its own. This
+ * can be turned off, for comparison, by setting lock_inheritance to 0.
+ *
+ * Waiters queue up in FIFO order. On release the lock is handed
+ * straight to the thread that has waited longest, which is the only
+ * one woken; nobody else can barge in ahead of it. Setting
+ * lock_handoff to 0 goes back to waking every waiter and letting them
+ * race for it.
+ *
+ * With the lockstat option, each lock also keeps contention statistics
+ * (see lockstat.h).
  */
 
 struct lock {
@@ -58,13 +100,26 @@ struct lock {
 	// (don't forget to mark things volatile as needed)
 	volatile int held;
 	volatile struct thread* holder;
+	struct lock *lk_nextheld;	/* next in holder's t_heldlocks */
+#if OPT_LOCKSTAT
+	struct lockstat lk_stat;	/* contention statistics */
+#endif
 };
 
+#define LOCK_MAXN 8
+
+extern int lock_inheritance;
+extern int lock_handoff;
+
 struct lock *lock_create(const char *name);
 void         lock_acquire(struct lock *);
+int          lock_tryacquire(struct lock *);
+int          lock_acquire_timeout(struct lock *, int ticks);
 void         lock_release(struct lock *);
 int          lock_do_i_hold(struct lock *);
 void         lock_destroy(struct lock *);
+void         lock_acquire_n(struct lock **, int n);
+void         lock_release_n(struct lock **, int n);
 void 		lock_acquire_two(struct lock*, struct lock*);
 void 		lock_release_two(struct lock*, struct lock*);
 void 		lock_acquire_three(struct lock*, struct lock*, struct lock*);
@@ -81,8 +136,11 @@ void 		lock_release_three(struct lock*, struct lock*, struct lock*);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_timedwait - As cv_wait, but stop waiting after TICKS hardclock
+ *                   ticks. Returns 0 if signalled, or ETIMEDOUT; either
+ *                   way the lock is held again on return.
  *
- * For all three operations, the current thread must hold the lock passed 
+ * For all of these operations, the current thread must hold the lock passed 
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
@@ -93,19 +151,123 @@ void 		lock_release_three(struct lock*, struct lock*, struct lock*);
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * Waiters queue up in FIFO order on the CV's wait channel, and are
+ * signalled in that order. A signal or broadcast given while holding
+ * the lock doesn't wake anyone: the waiters are moved straight onto
+ * the lock's queue ("wait morphing"), and run only once the lock is
+ * handed to them.
  */
 
 struct cv {
 	char *name;
-	// add what you need here
-	// (don't forget to mark things volatile as needed)
-	// struct array * wait_queue;
+	volatile int cv_nwaiters;	/* threads in cv_wait */
 };
 
 struct cv *cv_create(const char *name);
 void       cv_wait(struct cv *cv, struct lock *lock);
+int        cv_timedwait(struct cv *cv, struct lock *lock, int ticks);
 void       cv_signal(struct cv *cv, struct lock *lock);
 void       cv_broadcast(struct cv *cv, struct lock *lock);
 void       cv_destroy(struct cv *);
 
+/*
+ * Reader-writer lock.
+ *
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Any number of
+ *                           threads can hold it for reading at once.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing. A writer holds it
+ *                           alone: no other writer and no readers.
+ *    rwlock_release_write - Give up the write hold.
+ *    rwlock_do_i_write    - Return true if the current thread holds the
+ *                           lock for writing; false otherwise.
+ *
+ * Writers have preference: once a writer is waiting, new readers wait
+ * too rather than keep it out indefinitely. Readers are let in in
+ * batches: when a writer releases the lock, every reader that queued
+ * up behind it gets in together, ahead of the next writer. Waiting
+ * writers are served in FIFO order, and the lock is handed straight
+ * to whoever is let in, as with struct lock.
+ *
+ * A thread must not take the lock for reading or writing if it
+ * already holds it either way. Read holds are not tied to a thread,
+ * and there is no priority inheritance.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct rwlock {
+	char *rw_name;
+	volatile int rw_readers;		/* read holds */
+	volatile struct thread *rw_writer;	/* write holder, if any */
+	volatile int rw_waitreaders;		/* readers asleep */
+	volatile int rw_waitwriters;		/* writers asleep */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void           rwlock_acquire_read(struct rwlock *);
+void           rwlock_release_read(struct rwlock *);
+void           rwlock_acquire_write(struct rwlock *);
+void           rwlock_release_write(struct rwlock *);
+int            rwlock_do_i_write(struct rwlock *);
+void           rwlock_destroy(struct rwlock *);
+
+/*
+ * Barrier.
+ *
+ * A barrier for N threads holds up each thread that calls
+ * barrier_wait until all N have; then they all go on together, and
+ * the barrier is ready for the next round.
+ *
+ * Operations:
+ *    barrier_create  - Make a barrier for N (at least 1) threads.
+ *    barrier_wait    - Wait for the rest. Returns 1 in exactly one of
+ *                      the threads of each round (the last to arrive)
+ *                      and 0 in the others, so one of them can be
+ *                      picked to do any single-threaded work between
+ *                      rounds.
+ *    barrier_destroy - Nobody may be waiting.
+ *
+ * The last thread to arrive wakes all the others in one go.
+ */
+
+struct barrier {
+	char *b_name;
+	int b_nthreads;			/* threads per round */
+	volatile int b_arrived;		/* threads waiting this round */
+	volatile unsigned b_round;	/* rounds completed */
+};
+
+struct barrier *barrier_create(const char *name, int nthreads);
+int             barrier_wait(struct barrier *);
+void            barrier_destroy(struct barrier *);
+
+/*
+ * Wait group.
+ *
+ * Waits for a number of things (threads, I/O requests, ...) to finish.
+ * The count starts at 0. waitgroup_add raises it by N for N new things
+ * to wait for; each calls waitgroup_done as it finishes. waitgroup_wait
+ * sleeps until the count is back to 0; any number of threads may wait,
+ * and the last waitgroup_done wakes them all in one go.
+ *
+ * waitgroup_add and waitgroup_done never sleep and may be called from
+ * interrupt handlers. Add before starting the thing that will call
+ * waitgroup_done, or the count may hit 0 early.
+ */
+
+struct waitgroup {
+	char *wg_name;
+	volatile int wg_count;		/* things not yet done */
+};
+
+struct waitgroup *waitgroup_create(const char *name);
+void              waitgroup_add(struct waitgroup *, int n);
+void              waitgroup_done(struct waitgroup *);
+void              waitgroup_wait(struct waitgroup *);
+void              waitgroup_destroy(struct waitgroup *);
+
 #endif /* _SYNCH_H_ */
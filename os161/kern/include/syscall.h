@@ -23,6 +23,14 @@ int sys_write(int fd, char* c, size_t size, int* retval);
 
 int sys_sbrk(int increment, int32_t*);
 
+int sys_nanosleep(time_t secs, unsigned long nsecs);
+
+int sys_getrusage(int pid, userptr_t ru);
+
+int sys_setshare(int pid, int tickets, int32_t *retval);
+
+int sys_kheapstats(userptr_t ks);
+
 int runprogram_execv(char *progname, int argc, char* argv[]);
 
 int runprogram(char *progname);
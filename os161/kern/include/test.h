@@ -27,6 +27,12 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int pitest(int, char **);
+int lockbench(int, char **);
+int rwtest(int, char **);
+int timedtest(int, char **);
+int bwtest(int, char **);
+int completionbench(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
@@ -39,6 +45,8 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int mallocbench(int, char **);
+int kmemcachetest(int, char **);
 int nettest(int, char **);
 
 /* Kernel menu system */
@@ -8,6 +8,8 @@
 /* Get machine-dependent stuff */
 #include <machine/pcb.h>
 #include <synch.h>
+#include <kern/resource.h>
+#include <schedlat.h>
 #define MAX_PID 512
 #define MIN_PID 1 //the following macros will be used in syscall.c and runprogram.c
 #define MAX_ARG_LEN 256
@@ -26,8 +28,16 @@ typedef struct PCB_T {
 	//#else
 	//struct cv* cv;
 	//#endif
+	struct rusage p_rusage;	/* usage of the process's thread once exited */
 } pcb_t;
 
+/*
+ * PCBs are allocated from pcb_cache (see kmem_cache.h), with their
+ * mutex already made.
+ */
+struct kmem_cache;
+extern struct kmem_cache pcb_cache;
+
 
 /******************** Global Process Table Lock ********************/ 
 struct lock * lock;
@@ -43,8 +53,33 @@ struct thread {
 	struct pcb t_pcb;
 	char *t_name;
 	const void *t_sleepaddr;
+	struct thread *t_wchan_next;	/* next channel in hash bucket */
+	struct thread *t_wq_next;	/* next thread on same channel */
+	struct thread *t_wq_tail;	/* last thread on channel (head only) */
 	char *t_stack;
+	size_t t_stacksize;	/* bytes at t_stack */
 	u_int32_t pID;
+
+	/* Scheduler state - see scheduler.c */
+	int t_priority;		/* current MLFQ level, 0 is highest */
+	int t_basepriority;	/* highest level this thread may reach */
+	int t_ticks;		/* ticks used of the current quantum */
+	int t_epoch;		/* aging generation last seen */
+	int t_inherit;		/* level inherited through locks */
+	int t_tickets;		/* stride class tickets; 0 if MLFQ */
+	u_int32_t t_stride;	/* STRIDE1 / t_tickets */
+	u_int32_t t_pass;	/* stride pass value */
+
+	/* Priority inheritance - see synch.c */
+	struct lock *t_heldlocks;	/* locks we hold */
+	struct lock *t_blockedon;	/* lock we're waiting for */
+
+	/* Accounting - see rusage.c */
+	struct rusage t_rusage;
+	time_t t_stampsecs;	/* time of last switch or make_runnable */
+	u_int32_t t_stampnsecs;
+	u_int32_t t_lathist[SCHEDLAT_NBUCKETS];	/* see schedlat.c */
+	int t_woken;		/* made runnable by thread_wakeup */
 	/**********************************************************/
 	/* Public thread members - can be used by other code      */
 	/**********************************************************/
@@ -86,6 +121,16 @@ int thread_fork(const char *name,
 		void (*func)(void *, unsigned long),
 		struct thread **ret);
 
+/*
+ * Same as thread_fork, for a thread that is going to run a user
+ * process. It gets a kernel stack of the size set with
+ * thread_setuserstack rather than the full STACK_SIZE.
+ */
+int thread_fork_user(const char *name, 
+		     void *data1, unsigned long data2, 
+		     void (*func)(void *, unsigned long),
+		     struct thread **ret);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -107,6 +152,21 @@ void thread_yield(void);
  */
 void thread_sleep(const void *addr);
 
+/*
+ * As thread_sleep, but wake up anyway after TICKS hardclock ticks.
+ * Returns 0 if woken by a wakeup on ADDR, or ETIMEDOUT if the time
+ * ran out. A thread that thread_wchan_move has moved to another
+ * address before then is no longer timed, and returns 0 when woken
+ * there. Interrupts must be disabled.
+ *
+ * If the caller keeps a count of the threads sleeping on ADDR, it
+ * passes it as NWAITERS (or NULL if it doesn't). When the time runs
+ * out the count is decremented in the same step that takes the thread
+ * off ADDR, so a wakeup that comes in before the thread gets to run
+ * doesn't count it as still there.
+ */
+int thread_sleep_timeout(const void *addr, int ticks, volatile int *nwaiters);
+
 void thread_join(struct thread *);
 
 void thread_detach(struct thread *);
@@ -117,7 +177,20 @@ void thread_detach(struct thread *);
  */
 void thread_wakeup(const void *addr);
 
-void thread_wakeup_single (const void * addr);
+/*
+ * Wake up only the thread that has been sleeping longest on the
+ * specified address, and return it (NULL if there was none).
+ * Interrupts must be disabled.
+ */
+struct thread *thread_wakeup_single (const void * addr);
+
+/*
+ * Move the thread that has been sleeping longest on FROM over to TO,
+ * leaving it asleep, and return it (NULL if there was none). It will
+ * be woken by a wakeup on TO rather than FROM, and is last in line
+ * there. Interrupts must be disabled.
+ */
+struct thread *thread_wchan_move(const void *from, const void *to);
 
 
 /*
@@ -126,6 +199,36 @@ void thread_wakeup_single (const void * addr);
  */
 int thread_hassleepers(const void *addr);
 
+/*
+ * Return the highest scheduling level (lowest number) of the threads
+ * sleeping on the specified address, or SCHED_NLEVELS if there are
+ * none. Interrupts must be disabled.
+ */
+int thread_sleepers_level(const void *addr);
+
+
+/*
+ * Thread cache. Exited threads are kept, stack and all, for reuse by
+ * thread_fork. thread_cache_reclaim frees everything in the cache and
+ * returns how many threads it freed; call it when memory is short.
+ * thread_cache_printstats prints the hit rate.
+ */
+int thread_cache_reclaim(void);
+void thread_cache_printstats(void);
+
+/*
+ * Kernel stack sizing. Stacks are filled with a pattern when a thread
+ * is forked, and how much of it got used is recorded when the thread
+ * exits. thread_stack_printstats reports the deepest use seen for each
+ * thread name, including threads still running. thread_setuserstack
+ * sets the stack size for thread_fork_user (a power of 2 from
+ * STACK_MINSIZE to STACK_SIZE); it returns an error code.
+ */
+#define STACK_MINSIZE 1024
+int thread_setuserstack(size_t size);
+size_t thread_getuserstack(void);
+void thread_stack_printstats(void);
+
 
 /*
  * Private thread functions.
@@ -0,0 +1,54 @@
+#ifndef _TIMEOUT_H_
+#define _TIMEOUT_H_
+
+/*
+ * Kernel timers.
+ *
+ * A struct timeout is a one-shot callback to be run from the timer
+ * interrupt a given number of hardclock ticks from now. The caller
+ * owns the structure; it must stay around until the callback has run
+ * or timeout_del has been called.
+ *
+ *     timeout_add   - arrange for FN(ARG) to be called after TICKS
+ *                     hardclock ticks (at least 1). TO must not already
+ *                     be pending. FN runs with interrupts off, in
+ *                     interrupt context, and must not sleep.
+ *     timeout_del   - cancel TO, which must have been passed to
+ *                     timeout_add at some point. Returns nonzero if it
+ *                     was still pending, 0 if it had already fired.
+ *     timeout_pending - nonzero if TO has been added and not yet fired
+ *                     or been cancelled.
+ *
+ *     thread_sleep_ticks - put the current thread to sleep for TICKS
+ *                     hardclock ticks.
+ *
+ *     timeout_ticks - number of hardclock ticks since boot.
+ *
+ * Private to the clock code:
+ *
+ *     timeout_tick  - advance the timer wheel by one tick and run
+ *                     whatever has expired. Called from hardclock.
+ *     timeout_nextevent - number of ticks until the next timeout is
+ *                     due, or MAX if nothing is due before then.
+ */
+
+struct timeout {
+	struct timeout *to_next;	/* next in wheel slot */
+	struct timeout **to_prevp;	/* link pointing to us; NULL if idle */
+	u_int32_t to_expire;		/* timeout_ticks value to fire at */
+	void (*to_fn)(void *);
+	void *to_arg;
+};
+
+void timeout_add(struct timeout *to, int ticks, void (*fn)(void *), void *arg);
+int timeout_del(struct timeout *to);
+int timeout_pending(struct timeout *to);
+
+void thread_sleep_ticks(int ticks);
+
+u_int32_t timeout_ticks(void);
+
+void timeout_tick(void);
+int timeout_nextevent(int max);
+
+#endif /* _TIMEOUT_H_ */
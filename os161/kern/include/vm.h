@@ -15,8 +15,14 @@ typedef enum FRAME_STATE {
 	FIXED, // kernel pages shall remain in physical memory, so does coremap itself
 	DIRTY, // newly allocated user pages shall be dirty
 	CLEAN, // never modified since swapped in
+	ZEROED, // free, and already filled with zeros by the idle loop
 } frame_state;
 
+struct pageref;
+
+/* Free frames come in two kinds; anything looking for one takes either. */
+#define FRAME_IS_FREE(f) ((f).state == FREE || (f).state == ZEROED)
+
 typedef struct Frame {
 	// struct thread* owner_thread; // could be the addrspace object as well
 	struct addrspace* addrspace;
@@ -25,6 +31,12 @@ typedef struct Frame {
 	vaddr_t mapped_vaddr; // the virtual address this frame is mapped to
 	frame_state state; // see below 
 	int num_pages_allocated; // number of contiguous pages in a single allocation (e.g., large kmalloc)
+	struct pageref *pageref; // kmalloc's record for a page of small blocks, or NULL
+	int buddy_order; // if a free buddy block starts here, its order; else -1
+	int buddy_next;	// free list links for that block (frame ids, -1 at the ends)
+	int buddy_prev;
+	int free_next; // if free, links in the list of free frames in the same state
+	int free_prev;
 } frame;
 
 
@@ -50,6 +62,14 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Where kmalloc keeps its pageref for the kernel page containing
+ * KVADDR, so kfree can find it without searching. NULL if the page
+ * isn't in the coremap (it was taken before vm_bootstrap, or there
+ * is no coremap).
+ */
+struct pageref **kpage_pagerefp(vaddr_t kvaddr);
+
 /******************************* Paging Related Macros   ******************************************/
 #define FIRST_LEVEL_PN 0xffc00000 /* mask to get the 1st-level pagetable index from vaddr (first 10 bits) */
 #define SEC_LEVEL_PN 0x003ff000	/* mask to get the 2nd-level pagetable index from vaddr (mid 10 bits) */
@@ -79,4 +99,14 @@ paddr_t load_swapped_page(struct addrspace* as, vaddr_t va);
 
 paddr_t alloc_page_userspace(vaddr_t va);
 
+void coremap_setfree(int frame_id);
+
+int vm_zero_idle(void);
+
+void vm_printstats(void);
+
+/* Fill in the page frame part of a struct kheapstats (kern/kheapstat.h). */
+struct kheapstats;
+void vm_getfragstats(struct kheapstats *ks);
+
 #endif /* _VM_H_ */
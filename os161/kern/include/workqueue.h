@@ -0,0 +1,55 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Deferred work.
+ *
+ * A workqueue is a list of pending work items and one or more kernel
+ * threads that run them. Interrupt handlers (and anything else that
+ * runs with interrupts off) can queue a work item to have the slow
+ * part of their job done later, at spl0, in thread context, where it
+ * is allowed to sleep.
+ *
+ *     work_init        - set up W to call FN(ARG). Must be done before
+ *                        W is first queued.
+ *     workqueue_add    - queue W on WQ. Safe to call from an interrupt
+ *                        handler. If W is already queued and hasn't
+ *                        started running yet, this does nothing, so the
+ *                        function runs once for any number of adds.
+ *                        The caller owns W; it must stay around until
+ *                        it has run.
+ *     workqueue_schedule - workqueue_add on the system workqueue. Before
+ *                        workqueue_bootstrap has run, W is called right
+ *                        away instead.
+ *
+ *     workqueue_create - make a new workqueue named NAME with NWORKERS
+ *                        threads. Returns NULL on error.
+ *     workqueue_destroy - stop WQ's threads and free it. Work that is
+ *                        still queued is run first.
+ *
+ *     workqueue_bootstrap - create the system workqueue.
+ *     workqueue_shutdown  - destroy it again.
+ *     workqueue_printstats - print statistics for every workqueue.
+ */
+
+struct work {
+	struct work *w_next;		/* next on queue */
+	void (*w_fn)(void *);
+	void *w_arg;
+	int w_queued;			/* nonzero while waiting to run */
+};
+
+struct workqueue;
+
+void work_init(struct work *w, void (*fn)(void *), void *arg);
+void workqueue_add(struct workqueue *wq, struct work *w);
+void workqueue_schedule(struct work *w);
+
+struct workqueue *workqueue_create(const char *name, int nworkers);
+void workqueue_destroy(struct workqueue *wq);
+
+void workqueue_bootstrap(void);
+void workqueue_shutdown(void);
+void workqueue_printstats(void);
+
+#endif /* _WORKQUEUE_H_ */
@@ -1,7 +1,11 @@
 #include <types.h>
 #include <lib.h>
 #include <vm.h>
+#include <thread.h>
 #include <machine/spl.h>
+#include <kmem_cache.h>
+#include <kern/kheapstat.h>
+#include <kmprof.h>
 
 static
 void
@@ -41,6 +45,11 @@ fill_deadbeef(void *vptr, size_t len)
 //    cannot recursively use the subpage allocator. (We could probably
 //    make that work, but it would be painful.)
 //
+//    So that kfree doesn't have to search that list, each page's
+//    coremap entry also points at its pageref (see kpage_pagerefp).
+//    Only pages taken before the VM system is up aren't in the
+//    coremap; kfree still has to search for those.
+//
 
 #undef  SLOW	/* consistency checks */
 #undef SLOWER	/* lots of consistency checks */
@@ -61,6 +70,10 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #error "Odd page size"
 #endif
 
+#if NSIZES != KHS_NCLASSES
+#error "KHS_NCLASSES in kern/kheapstat.h doesn't match sizes[]"
+#endif
+
 ////////////////////////////////////////
 
 struct freelist {
@@ -286,7 +299,7 @@ dumpsubpage(struct pageref *pr)
 }
 
 void
-kheap_printstats(void)
+kheap_printpages(void)
 {
 	struct pageref *pr;
 
@@ -358,6 +371,7 @@ subpage_kmalloc(size_t sz)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
 	void *retptr;		// our result
+	struct pageref **prp;	// where the coremap keeps pr
 
 	volatile int i;
 
@@ -431,6 +445,11 @@ subpage_kmalloc(size_t sz)
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
 
+	prp = kpage_pagerefp(prpage);
+	if (prp != NULL) {
+		*prp = pr;
+	}
+
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
 	 * using in spring 2001 attempted to optimize this loop and
@@ -467,6 +486,7 @@ subpage_kfree(void *ptr)
 	int blktype;		// index into sizes[] that we're using
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
+	struct pageref **prp;	// where the coremap keeps pr
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *fl;	// free list entry
@@ -478,16 +498,18 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		assert(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+	prp = kpage_pagerefp(ptraddr);
+	if (prp != NULL) {
+		/* The coremap knows; NULL means it's not a subpage page. */
+		pr = *prp;
+	}
+	else {
+		/* From before the coremap; search for it. */
+		for (pr = allbase; pr; pr = pr->next_all) {
+			prpage = PR_PAGEADDR(pr);
+			if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
+				break;
+			}
 		}
 	}
 
@@ -497,6 +519,14 @@ subpage_kfree(void *ptr)
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	assert(blktype>=0 && blktype<NSIZES);
+	assert(ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -529,6 +559,9 @@ subpage_kfree(void *ptr)
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
+		if (prp != NULL) {
+			*prp = NULL;
+		}
 		free_kpages(prpage);
 		freepageref(pr);
 	}
@@ -542,8 +575,9 @@ subpage_kfree(void *ptr)
 //
 ////////////////////////////////////////////////////////////
 
+static
 void *
-kmalloc(size_t sz)
+kmalloc_once(size_t sz)
 {
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
@@ -562,6 +596,76 @@ kmalloc(size_t sz)
 	return subpage_kmalloc(sz);
 }
 
+////////////////////////////////////////////////////////////
+//
+// Statistics, for kheap_printstats and the kheapstats system call.
+// See kern/kheapstat.h.
+
+static u_int32_t class_nalloc[NSIZES];
+static u_int32_t class_reqbytes[NSIZES];
+static u_int32_t big_nalloc, big_reqbytes, big_pages;
+static u_int32_t req_hist[KHS_NHIST];
+
+/*
+ * Count a successful kmalloc of SZ bytes.
+ */
+static
+void
+kheap_count(size_t sz)
+{
+	unsigned b;
+	size_t limit;
+	int spl;
+
+	spl = splhigh();
+
+	for (b=0, limit=KHS_HISTMIN;
+	     b < KHS_NHIST-1 && sz > limit; b++) {
+		limit *= 2;
+	}
+	req_hist[b]++;
+
+	if (sz>=LARGEST_SUBPAGE_SIZE) {
+		big_nalloc++;
+		big_reqbytes += sz;
+		big_pages += (sz + PAGE_SIZE - 1)/PAGE_SIZE;
+	}
+	else {
+		b = blocktype(sz);
+		class_nalloc[b]++;
+		class_reqbytes[b] += sz;
+	}
+
+	splx(spl);
+}
+
+void *
+kmalloc(size_t sz)
+{
+	return kmalloc_from(sz, KMPROF_CALLER());
+}
+
+void *
+kmalloc_from(size_t sz, vaddr_t site)
+{
+	void *ptr;
+
+	ptr = kmalloc_once(sz);
+	if (ptr == NULL && thread_cache_reclaim() > 0) {
+		/* Freed some cached thread stacks; try again. */
+		ptr = kmalloc_once(sz);
+	}
+	if (ptr == NULL && kmem_cache_reap() > 0) {
+		/* Freed some cached objects; try again. */
+		ptr = kmalloc_once(sz);
+	}
+	if (ptr != NULL) {
+		kheap_count(sz);
+		kmprof_alloc(ptr, sz, site);
+	}
+	return ptr;
+}
+
 void
 kfree(void *ptr)
 {
@@ -570,9 +674,125 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	kmprof_free(ptr);
+	if (subpage_kfree(ptr)) {
 		assert((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
 }
 
+
+void
+kheap_getstats(struct kheapstats *ks)
+{
+	struct pageref *pr;
+	unsigned i;
+	int spl;
+
+	bzero(ks, sizeof(*ks));
+
+	spl = splhigh();
+
+	for (i=0; i<NSIZES; i++) {
+		ks->khs_size[i] = sizes[i];
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			ks->khs_pages[i]++;
+			if (pr->nfree > 0) {
+				ks->khs_partial[i]++;
+			}
+			ks->khs_inuse[i] += PAGE_SIZE / sizes[i] - pr->nfree;
+		}
+		ks->khs_nalloc[i] = class_nalloc[i];
+		ks->khs_reqbytes[i] = class_reqbytes[i];
+	}
+	ks->khs_bignalloc = big_nalloc;
+	ks->khs_bigreqbytes = big_reqbytes;
+	ks->khs_bigpages = big_pages;
+	for (i=0; i<KHS_NHIST; i++) {
+		ks->khs_hist[i] = req_hist[i];
+	}
+
+	splx(spl);
+
+	vm_getfragstats(ks);
+}
+
+/*
+ * A * 100 / B, without overflowing as long as the answer fits.
+ */
+static
+u_int32_t
+kheap_scale100(u_int32_t a, u_int32_t b)
+{
+	u_int32_t q = a / b, r = a % b;
+
+	if (r < 0xffffffff / 100) {
+		return q*100 + r*100/b;
+	}
+	return q*100 + r/(b/100);
+}
+
+void
+kheap_printstats(void)
+{
+	struct kheapstats ks;
+	u_int32_t avg100, limit;
+	unsigned i;
+
+	kheap_getstats(&ks);
+
+	kprintf("Subpage allocator (avg and used are over all allocations):\n");
+	kprintf("%5s %6s %7s %7s %10s %8s %5s\n", "size", "pages",
+		"partial", "inuse", "allocs", "avg", "used");
+	for (i=0; i<KHS_NCLASSES; i++) {
+		kprintf("%5lu %6lu %7lu %7lu %10lu ",
+			(unsigned long) ks.khs_size[i],
+			(unsigned long) ks.khs_pages[i],
+			(unsigned long) ks.khs_partial[i],
+			(unsigned long) ks.khs_inuse[i],
+			(unsigned long) ks.khs_nalloc[i]);
+		if (ks.khs_nalloc[i] == 0) {
+			kprintf("%8s %5s\n", "-", "-");
+			continue;
+		}
+		avg100 = kheap_scale100(ks.khs_reqbytes[i], ks.khs_nalloc[i]);
+		kprintf("%5lu.%02lu %4lu%%\n",
+			(unsigned long) avg100 / 100,
+			(unsigned long) avg100 % 100,
+			(unsigned long) avg100 / ks.khs_size[i]);
+	}
+
+	kprintf("Whole pages: %lu allocs, %lu pages",
+		(unsigned long) ks.khs_bignalloc,
+		(unsigned long) ks.khs_bigpages);
+	if (ks.khs_bigpages > 0) {
+		kprintf(", %lu%% used", (unsigned long)
+			kheap_scale100(ks.khs_bigreqbytes, ks.khs_bigpages)
+			/ PAGE_SIZE);
+	}
+	kprintf("\n");
+
+	kprintf("Request sizes:\n");
+	for (i=0, limit=KHS_HISTMIN; i<KHS_NHIST; i++, limit*=2) {
+		if (i < KHS_NHIST-1) {
+			kprintf("  <= %-6lu", (unsigned long) limit);
+		}
+		else {
+			kprintf("   > %-6lu", (unsigned long) limit/2);
+		}
+		kprintf(" %10lu\n", (unsigned long) ks.khs_hist[i]);
+	}
+
+	kprintf("Page frames: %lu managed, %lu free; largest free run %lu, "
+		"largest free block %lu",
+		(unsigned long) ks.khs_frames,
+		(unsigned long) ks.khs_freeframes,
+		(unsigned long) ks.khs_largestrun,
+		(unsigned long) ks.khs_largestblock);
+	if (ks.khs_freeframes > 0) {
+		kprintf(" (%lu%% fragmented)", (unsigned long)
+			(100 - ks.khs_largestrun * 100 / ks.khs_freeframes));
+	}
+	kprintf("\n");
+}
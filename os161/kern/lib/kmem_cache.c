@@ -0,0 +1,326 @@
+/*
+ * Object caches.
+ *
+ * Each cache keeps its free objects in a small array in the cache
+ * structure itself, so there's nothing to set up and a hit is just a
+ * pop with interrupts off. Objects that don't fit go back to kfree.
+ * Constructors and destructors are called with the interrupt level
+ * left as the caller had it, since they may well call kmalloc or kfree
+ * themselves.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <kmem_cache.h>
+#include <kmprof.h>
+
+/* All caches that have been used, for statistics and reaping. */
+static struct kmem_cache *allcaches;
+
+/*
+ * Put CACHE on the list and size its free array, the first time it's
+ * used. Interrupts must be off.
+ */
+static
+void
+kmem_cache_setup(struct kmem_cache *cache)
+{
+	int maxfree;
+
+	assert(curspl>0);
+
+	if (cache->kc_listed) {
+		return;
+	}
+
+	assert(cache->kc_size > 0);
+	maxfree = KMEM_CACHE_MAXIDLE / cache->kc_size;
+	if (maxfree < 2) {
+		maxfree = 2;
+	}
+	if (maxfree > KMEM_CACHE_NFREE) {
+		maxfree = KMEM_CACHE_NFREE;
+	}
+	cache->kc_maxfree = maxfree;
+
+	cache->kc_next = allcaches;
+	allcaches = cache;
+	cache->kc_listed = 1;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *cache;
+	int i;
+
+	cache = kmalloc(sizeof(struct kmem_cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->kc_name = kstrdup(name);
+	if (cache->kc_name == NULL) {
+		kfree(cache);
+		return NULL;
+	}
+	cache->kc_size = size;
+	cache->kc_ctor = ctor;
+	cache->kc_dtor = dtor;
+	cache->kc_next = NULL;
+	cache->kc_listed = 0;
+	cache->kc_reaping = 0;
+	cache->kc_dynamic = 1;
+	cache->kc_maxfree = 0;
+	cache->kc_nfree = 0;
+	for (i=0; i<KMEM_CACHE_NFREE; i++) {
+		cache->kc_free[i] = NULL;
+	}
+	cache->kc_inuse = cache->kc_maxinuse = 0;
+	cache->kc_nalloc = cache->kc_nhit = 0;
+	cache->kc_nctor = cache->kc_ndtor = 0;
+
+	return cache;
+}
+
+/*
+ * Destroy and kfree one object that's no longer wanted.
+ */
+static
+void
+kmem_cache_release(struct kmem_cache *cache, void *obj)
+{
+	int spl;
+
+	if (cache->kc_dtor != NULL) {
+		cache->kc_dtor(obj);
+	}
+	kfree(obj);
+
+	spl = splhigh();
+	cache->kc_ndtor++;
+	splx(spl);
+}
+
+/*
+ * Take every kept object off CACHE and free them. Returns how many.
+ */
+static
+int
+kmem_cache_drain(struct kmem_cache *cache)
+{
+	void *objs[KMEM_CACHE_NFREE];
+	int i, n, spl;
+
+	spl = splhigh();
+	n = cache->kc_nfree;
+	for (i=0; i<n; i++) {
+		objs[i] = cache->kc_free[i];
+		cache->kc_free[i] = NULL;
+	}
+	cache->kc_nfree = 0;
+	splx(spl);
+
+	for (i=0; i<n; i++) {
+		kmem_cache_release(cache, objs[i]);
+	}
+	return n;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *cache)
+{
+	struct kmem_cache **p;
+	int spl;
+
+	assert(cache->kc_dynamic);
+
+	kmem_cache_drain(cache);
+
+	spl = splhigh();
+	/*
+	 * A reap may be in the middle of draining us, or about to move on
+	 * through our kc_next; it has to be done with us before we come
+	 * off the list.
+	 */
+	while (cache->kc_reaping > 0) {
+		thread_sleep(cache);
+	}
+	if (cache->kc_listed) {
+		for (p = &allcaches; *p != cache; p = &(*p)->kc_next) {
+			assert(*p != NULL);
+		}
+		*p = cache->kc_next;
+	}
+	if (cache->kc_inuse > 0) {
+		kprintf("kmem_cache_destroy: %s: %d objects still in use\n",
+			cache->kc_name, cache->kc_inuse);
+	}
+	splx(spl);
+
+	kfree((char *)cache->kc_name);
+	kfree(cache);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *cache)
+{
+	vaddr_t site = KMPROF_CALLER();
+	void *obj = NULL;
+	int hit = 0;
+	int spl;
+
+	spl = splhigh();
+	kmem_cache_setup(cache);
+	if (cache->kc_nfree > 0) {
+		cache->kc_nfree--;
+		obj = cache->kc_free[cache->kc_nfree];
+		cache->kc_free[cache->kc_nfree] = NULL;
+		hit = 1;
+	}
+	splx(spl);
+
+	if (obj == NULL) {
+		obj = kmalloc_from(cache->kc_size, site);
+		if (obj == NULL) {
+			return NULL;
+		}
+		if (cache->kc_ctor != NULL && cache->kc_ctor(obj)) {
+			kfree(obj);
+			return NULL;
+		}
+	}
+	else {
+		/* charge the kept object to its new owner */
+		kmprof_retag(obj, site);
+	}
+
+	spl = splhigh();
+	cache->kc_nalloc++;
+	if (hit) {
+		cache->kc_nhit++;
+	}
+	else {
+		cache->kc_nctor++;
+	}
+	cache->kc_inuse++;
+	if (cache->kc_inuse > cache->kc_maxinuse) {
+		cache->kc_maxinuse = cache->kc_inuse;
+	}
+	splx(spl);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	int kept = 0;
+	int spl;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	spl = splhigh();
+	assert(cache->kc_listed);
+	cache->kc_inuse--;
+	if (cache->kc_nfree < cache->kc_maxfree) {
+		cache->kc_free[cache->kc_nfree++] = obj;
+		kept = 1;
+	}
+	splx(spl);
+
+	if (!kept) {
+		kmem_cache_release(cache, obj);
+	}
+}
+
+/*
+ * Draining runs destructors with interrupts on, so a cache could be
+ * destroyed under our feet. Each cache is marked as being reaped while
+ * we work on it, and kmem_cache_destroy waits for that to clear; the
+ * next cache is marked before letting go of this one, while this one
+ * is still on the list and its kc_next can be trusted.
+ */
+int
+kmem_cache_reap(void)
+{
+	struct kmem_cache *cache, *next;
+	int n = 0;
+	int spl;
+
+	spl = splhigh();
+	cache = allcaches;
+	if (cache != NULL) {
+		cache->kc_reaping++;
+	}
+	splx(spl);
+
+	while (cache != NULL) {
+		n += kmem_cache_drain(cache);
+
+		spl = splhigh();
+		next = cache->kc_next;
+		if (next != NULL) {
+			next->kc_reaping++;
+		}
+		cache->kc_reaping--;
+		if (cache->kc_reaping == 0) {
+			thread_wakeup(cache);
+		}
+		splx(spl);
+
+		cache = next;
+	}
+
+	return n;
+}
+
+/*
+ * PART as a percentage of WHOLE, without overflowing 32 bits.
+ */
+static
+u_int32_t
+kmem_cache_percent(u_int32_t part, u_int32_t whole)
+{
+	if (whole < 0x01000000) {
+		return part * 100 / whole;
+	}
+	return part / (whole / 100);
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *cache;
+	int spl;
+
+	/* print the whole thing with interrupts off */
+	spl = splhigh();
+
+	kprintf("%-16s %5s %6s %6s %5s %10s %4s %8s %8s\n",
+		"cache", "size", "inuse", "max", "kept", "allocs", "hit%",
+		"ctor", "dtor");
+	for (cache = allcaches; cache != NULL; cache = cache->kc_next) {
+		kprintf("%-16s %5lu %6d %6d %2d/%-2d %10lu ",
+			cache->kc_name, (unsigned long) cache->kc_size,
+			cache->kc_inuse, cache->kc_maxinuse,
+			cache->kc_nfree, cache->kc_maxfree,
+			(unsigned long) cache->kc_nalloc);
+		if (cache->kc_nalloc > 0) {
+			kprintf("%4lu", (unsigned long)
+				kmem_cache_percent(cache->kc_nhit,
+						   cache->kc_nalloc));
+		}
+		else {
+			kprintf("%4s", "-");
+		}
+		kprintf(" %8lu %8lu\n", (unsigned long) cache->kc_nctor,
+			(unsigned long) cache->kc_ndtor);
+	}
+
+	splx(spl);
+}
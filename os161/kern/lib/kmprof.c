@@ -0,0 +1,418 @@
+/*
+ * Kernel heap call-site profiler. See kmprof.h.
+ *
+ * Everything is in static tables, since it can't very well kmalloc
+ * its own memory. Sites are kept in an open-addressed hash table and
+ * never removed, so a site stays at the same index and the snapshot
+ * can be a plain copy of the table. Live blocks are kept in a chained
+ * hash table keyed on the block's address.
+ *
+ * All of it runs with interrupts off.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <kmprof.h>
+
+#define KMPROF_NBUCKETS	512	/* live block hash chains; power of 2 */
+#define KMPROF_NONE	0xffff	/* end of a chain */
+
+/* Most sites kmprof_print and kmprof_diff will list. */
+#define KMPROF_MAXPRINT	32
+
+struct kmsite {
+	vaddr_t ks_site;		/* return address; 0 if unused */
+	u_int32_t ks_livebytes;		/* bytes allocated and not freed */
+	u_int32_t ks_livecount;		/* blocks allocated and not freed */
+	u_int32_t ks_nalloc;		/* total allocations */
+	u_int32_t ks_totbytes;		/* total bytes allocated */
+};
+
+struct kmlive {
+	void *kl_ptr;
+	u_int32_t kl_size;
+	u_int16_t kl_site;		/* index into sites[] */
+	u_int16_t kl_next;		/* next in chain or free list */
+};
+
+static struct kmsite sites[KMPROF_NSITES];
+static struct kmsite snap[KMPROF_NSITES];
+static int nsites, havesnap;
+
+static struct kmlive live[KMPROF_NLIVE];
+static u_int16_t buckets[KMPROF_NBUCKETS];
+static u_int16_t freelive;
+static int liveready;
+
+/*
+ * Blocks not tracked because live[] was full, their bytes, and kfrees
+ * of them (any block kfree can't find).
+ */
+static u_int32_t untracked, untrackedbytes, untrackedfrees;
+
+/*
+ * Set up the live block free list and empty chains, the first time.
+ */
+static
+void
+kmprof_setup(void)
+{
+	int i;
+
+	assert(curspl>0);
+
+	if (liveready) {
+		return;
+	}
+	for (i=0; i<KMPROF_NLIVE; i++) {
+		live[i].kl_next = (i+1 < KMPROF_NLIVE) ? i+1 : KMPROF_NONE;
+	}
+	freelive = 0;
+	for (i=0; i<KMPROF_NBUCKETS; i++) {
+		buckets[i] = KMPROF_NONE;
+	}
+	liveready = 1;
+}
+
+/*
+ * Index of SITE in sites[], adding it if it's new. When the table is
+ * (nearly) full, new sites share slot 0 with the null site.
+ */
+static
+unsigned
+kmprof_site(vaddr_t site)
+{
+	unsigned i;
+
+	if (site == 0) {
+		return 0;
+	}
+	i = (site >> 2) & (KMPROF_NSITES-1);
+	if (i == 0) {
+		/* slot 0 is kept for site 0 */
+		i = 1;
+	}
+	while (sites[i].ks_site != site) {
+		if (sites[i].ks_site == 0) {
+			if (nsites >= KMPROF_NSITES*3/4) {
+				return 0;
+			}
+			sites[i].ks_site = site;
+			nsites++;
+			return i;
+		}
+		i = (i+1) & (KMPROF_NSITES-1);
+		if (i == 0) {
+			i = 1;
+		}
+	}
+	return i;
+}
+
+static
+unsigned
+kmprof_bucket(void *ptr)
+{
+	vaddr_t p = (vaddr_t)ptr;
+
+	/* blocks are at least 16-byte aligned */
+	return ((p >> 4) ^ (p >> 13)) & (KMPROF_NBUCKETS-1);
+}
+
+/*
+ * Find PTR's live block entry. Returns a pointer to the link that
+ * points at it, or NULL if it isn't tracked.
+ */
+static
+u_int16_t *
+kmprof_findlive(void *ptr)
+{
+	u_int16_t *lp;
+
+	for (lp = &buckets[kmprof_bucket(ptr)]; *lp != KMPROF_NONE;
+	     lp = &live[*lp].kl_next) {
+		if (live[*lp].kl_ptr == ptr) {
+			return lp;
+		}
+	}
+	return NULL;
+}
+
+void
+kmprof_alloc(void *ptr, size_t sz, vaddr_t site)
+{
+	struct kmlive *kl;
+	unsigned s, b;
+	u_int16_t n;
+	int spl;
+
+	spl = splhigh();
+	kmprof_setup();
+
+	s = kmprof_site(site);
+	sites[s].ks_nalloc++;
+	sites[s].ks_totbytes += sz;
+
+	if (freelive == KMPROF_NONE) {
+		/* can't tell when it's freed, so don't count it as live */
+		untracked++;
+		untrackedbytes += sz;
+		splx(spl);
+		return;
+	}
+	sites[s].ks_livebytes += sz;
+	sites[s].ks_livecount++;
+
+	n = freelive;
+	kl = &live[n];
+	freelive = kl->kl_next;
+
+	kl->kl_ptr = ptr;
+	kl->kl_size = sz;
+	kl->kl_site = s;
+	b = kmprof_bucket(ptr);
+	kl->kl_next = buckets[b];
+	buckets[b] = n;
+
+	splx(spl);
+}
+
+void
+kmprof_free(void *ptr)
+{
+	struct kmlive *kl;
+	u_int16_t *lp, n;
+	int spl;
+
+	spl = splhigh();
+	kmprof_setup();
+
+	lp = kmprof_findlive(ptr);
+	if (lp == NULL) {
+		untrackedfrees++;
+		splx(spl);
+		return;
+	}
+	n = *lp;
+	kl = &live[n];
+	*lp = kl->kl_next;
+
+	sites[kl->kl_site].ks_livebytes -= kl->kl_size;
+	sites[kl->kl_site].ks_livecount--;
+
+	kl->kl_ptr = NULL;
+	kl->kl_next = freelive;
+	freelive = n;
+
+	splx(spl);
+}
+
+void
+kmprof_retag(void *ptr, vaddr_t site)
+{
+	struct kmlive *kl;
+	u_int16_t *lp;
+	unsigned s;
+	int spl;
+
+	spl = splhigh();
+	kmprof_setup();
+
+	s = kmprof_site(site);
+	sites[s].ks_nalloc++;
+
+	lp = kmprof_findlive(ptr);
+	if (lp != NULL) {
+		kl = &live[*lp];
+		sites[s].ks_totbytes += kl->kl_size;
+		if (kl->kl_site != s) {
+			sites[kl->kl_site].ks_livebytes -= kl->kl_size;
+			sites[kl->kl_site].ks_livecount--;
+			sites[s].ks_livebytes += kl->kl_size;
+			sites[s].ks_livecount++;
+			kl->kl_site = s;
+		}
+	}
+
+	splx(spl);
+}
+
+/*
+ * Change in site I's live bytes since the snapshot. A site added
+ * since then started from nothing.
+ */
+static
+int32_t
+kmprof_growth(unsigned i)
+{
+	if (snap[i].ks_site != sites[i].ks_site) {
+		return sites[i].ks_livebytes;
+	}
+	return (int32_t)(sites[i].ks_livebytes - snap[i].ks_livebytes);
+}
+
+/*
+ * Nonzero if site A ranks above site B: by growth since the snapshot
+ * if DIFF is set, otherwise by live bytes.
+ */
+static
+int
+kmprof_ranks(unsigned a, unsigned b, int diff)
+{
+	if (diff) {
+		return kmprof_growth(a) > kmprof_growth(b);
+	}
+	return sites[a].ks_livebytes > sites[b].ks_livebytes;
+}
+
+/*
+ * Fill TOP with the N highest-ranked sites, highest first. Returns
+ * how many there were.
+ */
+static
+int
+kmprof_top(unsigned *top, int n, int diff)
+{
+	unsigned s;
+	int i, j, ntop = 0;
+
+	for (s=0; s<KMPROF_NSITES; s++) {
+		if (s > 0 && sites[s].ks_site == 0) {
+			continue;
+		}
+		if (sites[s].ks_nalloc == 0) {
+			continue;
+		}
+		if (diff && kmprof_growth(s) == 0) {
+			continue;
+		}
+		for (i = ntop; i > 0 && kmprof_ranks(s, top[i-1], diff); i--) {
+			/* nothing */
+		}
+		if (i >= n) {
+			continue;
+		}
+		if (ntop < n) {
+			ntop++;
+		}
+		for (j = ntop-1; j > i; j--) {
+			top[j] = top[j-1];
+		}
+		top[i] = s;
+	}
+	return ntop;
+}
+
+static
+void
+kmprof_printsite(unsigned s)
+{
+	if (s == 0) {
+		kprintf("%-10s ", "(other)");
+	}
+	else {
+		kprintf("0x%08lx ", (unsigned long) sites[s].ks_site);
+	}
+}
+
+/*
+ * Warn, ahead of a report, if the live block table has overflowed.
+ */
+static
+void
+kmprof_printuntracked(void)
+{
+	if (untracked > 0) {
+		kprintf("WARNING: live block table (%d entries) overflowed: "
+			"%lu blocks, %lu bytes,\n", KMPROF_NLIVE,
+			(unsigned long) untracked,
+			(unsigned long) untrackedbytes);
+		kprintf("WARNING: not counted as live below; %lu of them "
+			"since freed\n", (unsigned long) untrackedfrees);
+	}
+}
+
+void
+kmprof_print(int n)
+{
+	unsigned top[KMPROF_MAXPRINT], s;
+	int i, ntop, spl;
+
+	if (n > KMPROF_MAXPRINT) {
+		n = KMPROF_MAXPRINT;
+	}
+
+	/* print the whole thing with interrupts off */
+	spl = splhigh();
+
+	kmprof_printuntracked();
+	ntop = kmprof_top(top, n, 0);
+
+	kprintf("%d sites; top %d by live bytes:\n", nsites, ntop);
+	kprintf("%-10s %10s %8s %10s %12s\n", "site", "live bytes",
+		"live", "allocs", "total bytes");
+	for (i=0; i<ntop; i++) {
+		s = top[i];
+		kmprof_printsite(s);
+		kprintf("%10lu %8lu %10lu %12lu\n",
+			(unsigned long) sites[s].ks_livebytes,
+			(unsigned long) sites[s].ks_livecount,
+			(unsigned long) sites[s].ks_nalloc,
+			(unsigned long) sites[s].ks_totbytes);
+	}
+
+	splx(spl);
+}
+
+void
+kmprof_snapshot(void)
+{
+	int spl;
+
+	spl = splhigh();
+	memcpy(snap, sites, sizeof(snap));
+	havesnap = 1;
+	splx(spl);
+}
+
+void
+kmprof_diff(int n)
+{
+	unsigned top[KMPROF_MAXPRINT], s;
+	u_int32_t livecount, nalloc;
+	int i, ntop, spl;
+
+	if (n > KMPROF_MAXPRINT) {
+		n = KMPROF_MAXPRINT;
+	}
+
+	spl = splhigh();
+
+	if (!havesnap) {
+		kprintf("No snapshot taken; counting from boot\n");
+	}
+	kmprof_printuntracked();
+	ntop = kmprof_top(top, n, 1);
+
+	kprintf("Top %d sites by growth in live bytes since the snapshot:\n",
+		ntop);
+	kprintf("%-10s %10s %8s %10s %10s\n", "site", "live bytes",
+		"live", "allocs", "now live");
+	for (i=0; i<ntop; i++) {
+		s = top[i];
+		livecount = sites[s].ks_livecount;
+		nalloc = sites[s].ks_nalloc;
+		if (snap[s].ks_site == sites[s].ks_site) {
+			livecount -= snap[s].ks_livecount;
+			nalloc -= snap[s].ks_nalloc;
+		}
+		kmprof_printsite(s);
+		kprintf("%10d %8d %10lu %10lu\n",
+			(int) kmprof_growth(s), (int) livecount,
+			(unsigned long) nalloc,
+			(unsigned long) sites[s].ks_livebytes);
+	}
+
+	splx(spl);
+}
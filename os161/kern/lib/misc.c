@@ -1,6 +1,7 @@
 #include <types.h>
 #include <kern/errmsg.h>
 #include <lib.h>
+#include <kmprof.h>
 
 /*
  * Like strdup, but calls kmalloc.
@@ -8,7 +9,7 @@
 char *
 kstrdup(const char *s)
 {
-	char *z = kmalloc(strlen(s)+1);
+	char *z = kmalloc_from(strlen(s)+1, KMPROF_CALLER());
 	if (z==NULL) {
 		return NULL;
 	}
@@ -11,6 +11,7 @@
 #include <synch.h>
 #include <thread.h>
 #include <scheduler.h>
+#include <workqueue.h>
 #include <dev.h>
 #include <vfs.h>
 #include <vm.h>
@@ -78,6 +79,7 @@ boot(void)
 	dev_bootstrap();
 	vm_bootstrap();
 	kprintf_bootstrap();
+	workqueue_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -101,6 +103,7 @@ shutdown(void)
 
 	kprintf("Shutting down.\n");
 	
+	workqueue_shutdown();
 	vfs_clearbootfs();
 	vfs_clearcurdir();
 	vfs_unmountall();
@@ -7,16 +7,27 @@
 #include <kern/unistd.h>
 #include <kern/limits.h>
 #include <lib.h>
+#include <machine/spl.h>
 #include <clock.h>
 #include <thread.h>
+#include <scheduler.h>
+#include <rusage.h>
+#include <schedlat.h>
+#include <workqueue.h>
+#include <lockstat.h>
+#include <kmprof.h>
+#include <kmem_cache.h>
 #include <syscall.h>
 #include <uio.h>
 #include <vfs.h>
+#include <vm.h>
 #include <sfs.h>
 #include <test.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
+#include "opt-kmprof.h"
 
 #define _PATH_SHELL "/bin/sh"
 
@@ -112,7 +123,7 @@ common_prog(int nargs, char **args)
 		"synchronization-problems kernel.\n");
 #endif
 	struct thread* temp ;
-	result = thread_fork(args[0] /* thread name */,
+	result = thread_fork_user(args[0] /* thread name */,
 			args /* thread arg */, nargs /* thread arg */,
 			cmd_progthread, &temp);
 	if (result) {
@@ -347,18 +358,317 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command for the kernel heap report. With "pages", also print a map
+ * of every page of small blocks.
+ */
 static
 int
 cmd_kheapstats(int nargs, char **args)
 {
-	(void)nargs;
-	(void)args;
+	if (nargs > 2 || (nargs == 2 && strcmp(args[1], "pages"))) {
+		kprintf("Usage: kh [pages]\n");
+		return EINVAL;
+	}
 
+	if (nargs == 2) {
+		kheap_printpages();
+	}
 	kheap_printstats();
+	thread_cache_printstats();
+	kmem_cache_printstats();
 	
 	return 0;
 }
 
+/*
+ * Command for the kernel stack report, or with an argument, setting
+ * the kernel stack size for user processes.
+ */
+static
+int
+cmd_kstack(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 1) {
+		thread_stack_printstats();
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: kstack [bytes]\n");
+		return EINVAL;
+	}
+
+	result = thread_setuserstack(atoi(args[1]));
+	if (result) {
+		kprintf("kstack: size must be a power of 2 from %d to %d\n",
+			STACK_MINSIZE, STACK_SIZE);
+		return result;
+	}
+	kprintf("User process kernel stacks are now %u bytes\n",
+		thread_getuserstack());
+	return 0;
+}
+
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for printing the locks with the most contention.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int n = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [count]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("Usage: lockstat [count]\n");
+			return EINVAL;
+		}
+	}
+
+	lockstat_print(n);
+
+	return 0;
+}
+
+static
+int
+cmd_lockstatreset(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_reset();
+
+	return 0;
+}
+#endif /* OPT_LOCKSTAT */
+
+#if OPT_KMPROF
+/*
+ * Commands for the kmalloc call-site profiler: the sites with the most
+ * live memory, and the ones that grew most since a snapshot.
+ */
+static
+int
+cmd_kmprof_common(int nargs, char **args, void (*print)(int))
+{
+	int n = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: %s [count]\n", args[0]);
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("Usage: %s [count]\n", args[0]);
+			return EINVAL;
+		}
+	}
+
+	print(n);
+
+	return 0;
+}
+
+static
+int
+cmd_kmprof(int nargs, char **args)
+{
+	return cmd_kmprof_common(nargs, args, kmprof_print);
+}
+
+static
+int
+cmd_kmdiff(int nargs, char **args)
+{
+	return cmd_kmprof_common(nargs, args, kmprof_diff);
+}
+
+static
+int
+cmd_kmsnap(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmprof_snapshot();
+
+	return 0;
+}
+#endif /* OPT_KMPROF */
+
+static
+int
+cmd_workqueues(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	workqueue_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_runqueues(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	scheduler_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for setting the scheduling priority of a process.
+ */
+static
+int
+cmd_setpriority(int nargs, char **args)
+{
+	int pid, level, result, spl;
+	struct thread *t;
+
+	if (nargs != 3) {
+		kprintf("Usage: pri pid level\n");
+		return EINVAL;
+	}
+
+	pid = atoi(args[1]);
+	level = atoi(args[2]);
+	if (pid < MIN_PID || pid >= MAX_PID) {
+		kprintf("pri: invalid pid %d\n", pid);
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	if (PCBs[pid] == NULL || PCBs[pid]->exited) {
+		splx(spl);
+		kprintf("pri: no such process %d\n", pid);
+		return EINVAL;
+	}
+	t = PCBs[pid]->this_thread;
+	result = scheduler_setpriority(t, level);
+	splx(spl);
+
+	if (result) {
+		kprintf("pri: level must be 0 to %d\n", SCHED_NLEVELS-1);
+	}
+	return result;
+}
+
+/*
+ * Command for printing CPU and scheduling statistics per process.
+ */
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	rusage_printall();
+
+	return 0;
+}
+
+/*
+ * Command for printing or resetting the scheduling latency histograms.
+ */
+static
+int
+cmd_schedlat(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		schedlat_reset();
+		kprintf("Latency histograms reset\n");
+		return 0;
+	}
+	if (nargs > 2) {
+		kprintf("Usage: lat [pid | reset]\n");
+		return EINVAL;
+	}
+
+	result = schedlat_print(nargs == 2 ? atoi(args[1]) : 0);
+	if (result) {
+		kprintf("lat: no such process %s\n", args[1]);
+	}
+	return result;
+}
+
+/*
+ * Command for showing or setting the scheduler time slice.
+ */
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: quantum [ticks]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		result = scheduler_setquantum(atoi(args[1]));
+		if (result) {
+			kprintf("quantum: must be 1 to %d ticks\n", HZ);
+			return result;
+		}
+	}
+
+	scheduler_printstats();
+	return 0;
+}
+
+/*
+ * Command for turning tickless idle on and off.
+ */
+static
+int
+cmd_tickless(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		hardclock_tickless = 1;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		hardclock_tickless = 0;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: tickless [on|off]\n");
+		return EINVAL;
+	}
+
+	kprintf("Tickless idle is %s\n", hardclock_tickless ? "on" : "off");
+	return 0;
+}
+
 
 ////////////////////////////////////////
 //
@@ -447,6 +757,8 @@ static const char *testmenu[] = {
 	"[qt]  Queue test                    ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] kmalloc benchmark [nlive]     ",
+	"[kc]  Object cache test             ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -456,6 +768,12 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Priority inversion test       ",
+	"[sy5] Lock contention benchmark     ",
+	"[sy6] Reader-writer lock test       ",
+	"[sy7] Try/timed wait test           ",
+	"[sy8] Barrier/wait group test       ",
+	"[sy9] Completion benchmark          ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress        (4)     ",
 	"[fs3] FS write stress       (4)     ",
@@ -489,7 +807,25 @@ static const char *mainmenu[] = {
 	"[1b] Cat/mouse with locks and CVs   ",
 	"[1c] Stoplight                      ",
 #endif
-	"[kh] Kernel heap stats              ",
+	"[kh] Kernel heap stats [pages]      ",
+	"[rq] Run queue stats                ",
+	"[pri] Set process priority          ",
+	"[quantum] Set scheduler time slice  ",
+	"[ps] Process CPU statistics         ",
+	"[lat] Scheduling latency histograms ",
+	"[tickless] Tickless idle on/off     ",
+	"[wq] Workqueue statistics           ",
+	"[vm] Page frame statistics          ",
+	"[kstack] Kernel stack use/size      ",
+#if OPT_LOCKSTAT
+	"[lockstat] Most contended locks     ",
+	"[lsreset] Reset lock statistics     ",
+#endif
+#if OPT_KMPROF
+	"[kmprof] Top kmalloc call sites     ",
+	"[kmsnap] Snapshot kmalloc sites     ",
+	"[kmdiff] kmalloc growth since snap  ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -574,6 +910,24 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "rq",         cmd_runqueues },
+	{ "pri",        cmd_setpriority },
+	{ "quantum",    cmd_quantum },
+	{ "tickless",   cmd_tickless },
+	{ "ps",         cmd_ps },
+	{ "lat",        cmd_schedlat },
+	{ "wq",         cmd_workqueues },
+	{ "vm",         cmd_vmstats },
+	{ "kstack",     cmd_kstack },
+#if OPT_LOCKSTAT
+	{ "lockstat",   cmd_lockstat },
+	{ "lsreset",    cmd_lockstatreset },
+#endif
+#if OPT_KMPROF
+	{ "kmprof",     cmd_kmprof },
+	{ "kmsnap",     cmd_kmsnap },
+	{ "kmdiff",     cmd_kmdiff },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -581,6 +935,8 @@ static struct {
 	{ "qt",		queuetest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+	{ "km3",	mallocbench },
+	{ "kc",		kmemcachetest },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -592,6 +948,12 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	pitest },
+	{ "sy5",	lockbench },
+	{ "sy6",	rwtest },
+	{ "sy7",	timedtest },
+	{ "sy8",	bwtest },
+	{ "sy9",	completionbench },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -0,0 +1,196 @@
+/*
+ * Test code for object caches.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <synch.h>
+#include <thread.h>
+#include <kmem_cache.h>
+#include <test.h>
+
+/*
+ * Make a cache whose constructor stamps each object and counts, check
+ * that freed objects come back constructed and that the constructor
+ * and destructor run once per object, then hammer the cache from
+ * KC_NTHREADS threads at once.
+ */
+
+#define KC_NOBJS	32
+#define KC_NTHREADS	8
+#define KC_NTRIES	2000
+#define KC_MAGIC	0xca5ef00d
+
+struct kctestobj {
+	u_int32_t ko_magic;		/* set by the constructor */
+	unsigned long ko_owner;		/* set by whoever has it */
+	char ko_payload[88];
+};
+
+static volatile int kc_nctor, kc_ndtor;
+static volatile int kc_failctor;
+static struct semaphore *kc_done;
+
+static
+int
+kc_ctor(void *obj)
+{
+	struct kctestobj *ko = obj;
+	int spl;
+
+	if (kc_failctor) {
+		return ENOMEM;
+	}
+	ko->ko_magic = KC_MAGIC;
+
+	spl = splhigh();
+	kc_nctor++;
+	splx(spl);
+	return 0;
+}
+
+static
+void
+kc_dtor(void *obj)
+{
+	struct kctestobj *ko = obj;
+	int spl;
+
+	if (ko->ko_magic != KC_MAGIC) {
+		panic("kmemcachetest: destroying an unconstructed object\n");
+	}
+	ko->ko_magic = 0;
+
+	spl = splhigh();
+	kc_ndtor++;
+	splx(spl);
+}
+
+static
+void
+kcthread(void *cp, unsigned long num)
+{
+	struct kmem_cache *cache = cp;
+	struct kctestobj *ko[2];
+	int i, j;
+
+	for (i=0; i<KC_NTRIES; i++) {
+		for (j=0; j<2; j++) {
+			ko[j] = kmem_cache_alloc(cache);
+			if (ko[j] == NULL) {
+				panic("kmemcachetest: thread %lu: "
+				      "kmem_cache_alloc failed\n", num);
+			}
+			if (ko[j]->ko_magic != KC_MAGIC) {
+				panic("kmemcachetest: thread %lu: "
+				      "got an unconstructed object\n", num);
+			}
+			ko[j]->ko_owner = num;
+		}
+		thread_yield();
+		for (j=0; j<2; j++) {
+			if (ko[j]->ko_owner != num) {
+				panic("kmemcachetest: thread %lu: object "
+				      "also handed to thread %lu\n", num,
+				      ko[j]->ko_owner);
+			}
+			kmem_cache_free(cache, ko[j]);
+		}
+	}
+	V(kc_done);
+}
+
+int
+kmemcachetest(int nargs, char **args)
+{
+	struct kmem_cache *cache;
+	struct kctestobj *ko[KC_NOBJS], *extra;
+	int i, result, before;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting object cache test...\n");
+
+	kc_nctor = kc_ndtor = 0;
+	kc_failctor = 0;
+	cache = kmem_cache_create("kctest", sizeof(struct kctestobj),
+				  kc_ctor, kc_dtor);
+	if (cache == NULL) {
+		panic("kmemcachetest: kmem_cache_create failed\n");
+	}
+
+	/* Fresh objects get constructed. */
+	for (i=0; i<KC_NOBJS; i++) {
+		ko[i] = kmem_cache_alloc(cache);
+		if (ko[i] == NULL) {
+			panic("kmemcachetest: kmem_cache_alloc failed\n");
+		}
+		if (ko[i]->ko_magic != KC_MAGIC) {
+			panic("kmemcachetest: got an unconstructed object\n");
+		}
+		bzero(ko[i]->ko_payload, sizeof(ko[i]->ko_payload));
+	}
+	if (kc_nctor != KC_NOBJS) {
+		panic("kmemcachetest: %d constructor calls for %d objects\n",
+		      kc_nctor, KC_NOBJS);
+	}
+	for (i=0; i<KC_NOBJS; i++) {
+		kmem_cache_free(cache, ko[i]);
+	}
+	kprintf("kmemcachetest: %d freed, %d kept\n", KC_NOBJS,
+		KC_NOBJS - kc_ndtor);
+
+	/* Kept ones come back without being constructed again. */
+	before = kc_nctor;
+	for (i=0; i<KC_NOBJS - kc_ndtor; i++) {
+		ko[i] = kmem_cache_alloc(cache);
+		if (ko[i] == NULL || ko[i]->ko_magic != KC_MAGIC) {
+			panic("kmemcachetest: bad object from the cache\n");
+		}
+	}
+	if (kc_nctor != before) {
+		panic("kmemcachetest: kept objects were constructed again\n");
+	}
+
+	/* With the cache empty, a failing constructor fails the alloc. */
+	kc_failctor = 1;
+	extra = kmem_cache_alloc(cache);
+	if (extra != NULL) {
+		panic("kmemcachetest: alloc succeeded with a failing "
+		      "constructor\n");
+	}
+	kc_failctor = 0;
+	for (i=0; i<KC_NOBJS - kc_ndtor; i++) {
+		kmem_cache_free(cache, ko[i]);
+	}
+
+	/* Now everyone at once. */
+	kc_done = sem_create("kctest", 0);
+	if (kc_done == NULL) {
+		panic("kmemcachetest: sem_create failed\n");
+	}
+	for (i=0; i<KC_NTHREADS; i++) {
+		result = thread_fork("kmemcachetest", cache, i, kcthread,
+				     NULL);
+		if (result) {
+			panic("kmemcachetest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<KC_NTHREADS; i++) {
+		P(kc_done);
+	}
+	sem_destroy(kc_done);
+
+	kmem_cache_printstats();
+	kmem_cache_destroy(cache);
+	if (kc_nctor != kc_ndtor) {
+		panic("kmemcachetest: %d objects constructed, %d destroyed\n",
+		      kc_nctor, kc_ndtor);
+	}
+
+	kprintf("Object cache test done\n");
+	return 0;
+}
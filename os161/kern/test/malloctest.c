@@ -2,9 +2,11 @@
  * Test code for kmalloc.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
 #include <thread.h>
+#include <clock.h>
 #include <test.h>
 
 /*
@@ -108,3 +110,106 @@ mallocstress(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * kmalloc/kfree throughput with a big live heap. Fill an array with
+ * KB_NLIVE (or the number given) blocks of random sizes up to
+ * KB_MAXSIZE, then KB_NOPS times free a random one and allocate a new
+ * one in its place. Each block is stamped with its slot number so
+ * that one handed out twice gets noticed.
+ */
+
+#define KB_NLIVE	500
+#define KB_MAXLIVE	2000
+#define KB_MAXSIZE	512
+#define KB_NOPS		20000
+
+static
+void *
+mb_alloc(unsigned slot)
+{
+	size_t sz;
+	unsigned *p;
+
+	sz = sizeof(unsigned) + random() % (KB_MAXSIZE - sizeof(unsigned));
+	p = kmalloc(sz);
+	if (p == NULL) {
+		return NULL;
+	}
+	*p = slot;
+	return p;
+}
+
+static
+void
+mb_free(void *ptr, unsigned slot)
+{
+	unsigned *p = ptr;
+
+	if (*p != slot) {
+		panic("mallocbench: block for slot %u has %u in it\n",
+		      slot, *p);
+	}
+	kfree(p);
+}
+
+int
+mallocbench(int nargs, char **args)
+{
+	static void *live[KB_MAXLIVE];
+	time_t secs1, secs2;
+	u_int32_t nsecs1, nsecs2;
+	unsigned long usecs, nsperop;
+	unsigned nlive, slot;
+	int i;
+
+	nlive = KB_NLIVE;
+	if (nargs == 2) {
+		nlive = atoi(args[1]);
+	}
+	if (nargs > 2 || nlive < 1 || nlive > KB_MAXLIVE) {
+		kprintf("Usage: km3 [live blocks, 1-%d]\n", KB_MAXLIVE);
+		return EINVAL;
+	}
+
+	kprintf("Starting kmalloc benchmark with %u live blocks...\n", nlive);
+
+	for (slot=0; slot<nlive; slot++) {
+		live[slot] = mb_alloc(slot);
+		if (live[slot] == NULL) {
+			kprintf("mallocbench: out of memory after %u blocks\n",
+				slot);
+			nlive = slot;
+			break;
+		}
+	}
+	if (nlive == 0) {
+		return ENOMEM;
+	}
+
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<KB_NOPS; i++) {
+		slot = random() % nlive;
+		mb_free(live[slot], slot);
+		live[slot] = mb_alloc(slot);
+		if (live[slot] == NULL) {
+			panic("mallocbench: kmalloc failed in steady state\n");
+		}
+	}
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
+
+	for (slot=0; slot<nlive; slot++) {
+		mb_free(live[slot], slot);
+	}
+
+	/* Good up to about an hour, which is plenty. */
+	usecs = secs2 * 1000000 + nsecs2 / 1000;
+	nsperop = (usecs / i) * 1000 + (usecs % i) * 1000 / i;
+	kprintf("%d kfree/kmalloc pairs in %lu.%09lu seconds "
+		"(%lu ns per pair)\n", i, (unsigned long) secs2,
+		(unsigned long) nsecs2, nsperop);
+	kprintf("kmalloc benchmark done\n");
+
+	return 0;
+}
@@ -3,11 +3,16 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <machine/spl.h>
 #include <synch.h>
 #include <thread.h>
 #include <test.h>
 #include <clock.h>
+#include <curthread.h>
+#include <scheduler.h>
+#include <timeout.h>
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
@@ -20,8 +25,36 @@ static volatile unsigned long testval3;
 static struct semaphore *testsem;
 static struct lock *testlock;
 static struct cv *testcv;
+static struct rwlock *testrw;
 static struct semaphore *donesem;
 
+/* Context switches made by the test threads, added up as they finish. */
+static volatile unsigned long switches;
+
+/*
+ * Return how many context switches curthread has made.
+ */
+static
+unsigned long
+curswitches(void)
+{
+	return curthread->t_rusage.ru_nvcsw + curthread->t_rusage.ru_nivcsw;
+}
+
+/*
+ * Add curthread's context switches into SWITCHES.
+ */
+static
+void
+countswitches(void)
+{
+	int spl;
+
+	spl = splhigh();
+	switches += curswitches();
+	splx(spl);
+}
+
 static
 void
 inititems(void)
@@ -44,6 +77,12 @@ inititems(void)
 			panic("synchtest: cv_create failed\n");
 		}
 	}
+	if (testrw==NULL) {
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("synchtest: rwlock_create failed\n");
+		}
+	}
 	if (donesem==NULL) {
 		donesem = sem_create("donesem", 0);
 		if (donesem == NULL) {
@@ -68,18 +107,27 @@ semtestthread(void *junk, unsigned long num)
 		kprintf("%c", (int)num+64);
 	}
 	kprintf("\n");
+	countswitches();
 	V(donesem);
 }
 
+/*
+ * Semaphore test. "sy1 wakeall" runs it with V waking every sleeper,
+ * to compare the number of context switches.
+ */
 int
 semtest(int nargs, char **args)
 {
-	int i, result;
+	unsigned long myswitches;
+	int i, result, saved, wakeall;
 
-	(void)nargs;
-	(void)args;
+	wakeall = (nargs == 2 && !strcmp(args[1], "wakeall"));
+	saved = sem_wakeone;
+	sem_wakeone = !wakeall;
 
 	inititems();
+	switches = 0;
+	myswitches = curswitches();
 	kprintf("Starting semaphore test...\n");
 	kprintf("If this hangs, it's broken: ");
 	P(testsem);
@@ -100,9 +148,15 @@ semtest(int nargs, char **args)
 	}
 
 	/* so we can run it again */
-	V(testsem);
-	V(testsem);
+	V_n(testsem, 2);
 
+	countswitches();
+	switches -= myswitches;
+	sem_wakeone = saved;
+
+	kprintf("%s: %lu context switches for %d threads\n",
+		wakeall ? "Wake all" : "Wake one",
+		switches, NTHREADS);
 	kprintf("Semaphore test done.\n");
 	return 0;
 }
@@ -273,3 +327,987 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Priority inversion test.
+ *
+ * A low-priority thread takes the lock and works for PI_CSTICKS. A
+ * high-priority thread then waits for the lock while a medium-priority
+ * thread burns the CPU for PI_HOGTICKS. Without priority inheritance
+ * the medium thread keeps the low one (and so the high one) off the
+ * processor; with it, the low thread runs at high priority until it
+ * lets go of the lock. The test runs both ways and reports how long
+ * the high-priority thread waited.
+ */
+
+#define PI_CSTICKS   (HZ/10)
+#define PI_HOGTICKS  (HZ*2)
+
+static struct semaphore *pisem;
+static volatile u_int32_t pi_waited;
+
+static
+void
+spin_ticks(u_int32_t n)
+{
+	u_int32_t start = timeout_ticks();
+
+	while (timeout_ticks() - start < n) {
+		/* burn cpu */
+	}
+}
+
+static
+void
+pi_lowthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	scheduler_setpriority(curthread, SCHED_NLEVELS-1);
+	lock_acquire(testlock);
+	V(pisem);
+	spin_ticks(PI_CSTICKS);
+	lock_release(testlock);
+	V(donesem);
+}
+
+static
+void
+pi_medthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	scheduler_setpriority(curthread, 1);
+	spin_ticks(PI_HOGTICKS);
+	V(donesem);
+}
+
+static
+void
+pi_highthread(void *junk, unsigned long num)
+{
+	u_int32_t start;
+
+	(void)junk;
+	(void)num;
+
+	scheduler_setpriority(curthread, 0);
+	start = timeout_ticks();
+	lock_acquire(testlock);
+	pi_waited = timeout_ticks() - start;
+	lock_release(testlock);
+	V(donesem);
+}
+
+static
+u_int32_t
+pi_round(int inherit)
+{
+	int i, result, saved;
+
+	saved = lock_inheritance;
+	lock_inheritance = inherit;
+
+	result = thread_fork("pi-low", NULL, 0, pi_lowthread, NULL);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	/* Wait for it to get the lock. */
+	P(pisem);
+
+	result = thread_fork("pi-high", NULL, 0, pi_highthread, NULL);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	result = thread_fork("pi-medium", NULL, 0, pi_medthread, NULL);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+
+	for (i=0; i<3; i++) {
+		P(donesem);
+	}
+
+	lock_inheritance = saved;
+	return pi_waited;
+}
+
+int
+pitest(int nargs, char **args)
+{
+	u_int32_t without, with;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (pisem==NULL) {
+		pisem = sem_create("pisem", 0);
+		if (pisem == NULL) {
+			panic("pitest: sem_create failed\n");
+		}
+	}
+
+	kprintf("Starting priority inversion test...\n");
+	kprintf("Critical section %d ticks, medium-priority hog %d ticks\n",
+		PI_CSTICKS, PI_HOGTICKS);
+
+	without = pi_round(0);
+	kprintf("Without inheritance: high-priority thread waited %lu ticks\n",
+		(unsigned long) without);
+
+	with = pi_round(1);
+	kprintf("With inheritance:    high-priority thread waited %lu ticks\n",
+		(unsigned long) with);
+
+	if (with > PI_CSTICKS * 2) {
+		kprintf("Priority inheritance doesn't seem to be working\n");
+	}
+
+	kprintf("Priority inversion test done\n");
+
+	return 0;
+}
+
+/*
+ * Lock contention benchmark.
+ *
+ * LB_NTHREADS threads each take the same lock LB_NLOOPS times, and
+ * yield while holding it so the others pile up waiting. Each thread
+ * adds up its context switches (from its rusage) at the end, and the
+ * test prints switches per acquire, first with waiters woken all at
+ * once on release and then with the lock handed to the next waiter.
+ * The yield accounts for one switch per acquire either way.
+ */
+
+#define LB_NTHREADS  8
+#define LB_NLOOPS    200
+
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<LB_NLOOPS; i++) {
+		lock_acquire(testlock);
+		testval1++;
+		thread_yield();
+		lock_release(testlock);
+	}
+
+	countswitches();
+	V(donesem);
+}
+
+static
+void
+lb_round(int handoff)
+{
+	time_t secs1, secs2;
+	u_int32_t nsecs1, nsecs2;
+	unsigned long acquires, per100;
+	int i, result, saved;
+
+	saved = lock_handoff;
+	lock_handoff = handoff;
+	testval1 = 0;
+	switches = 0;
+
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<LB_NTHREADS; i++) {
+		result = thread_fork("lockbench", NULL, i, lockbenchthread,
+				     NULL);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<LB_NTHREADS; i++) {
+		P(donesem);
+	}
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
+
+	lock_handoff = saved;
+
+	acquires = LB_NTHREADS * LB_NLOOPS;
+	if (testval1 != acquires) {
+		kprintf("lockbench: counted %lu acquires, expected %lu\n",
+			testval1, acquires);
+		panic("lockbench: lock didn't exclude\n");
+	}
+
+	per100 = switches * 100 / acquires;
+	kprintf("%s: %lu switches, %lu.%02lu per acquire, %lu.%09lu seconds\n",
+		handoff ? "Handoff  " : "Wake all ", switches,
+		per100 / 100, per100 % 100,
+		(unsigned long) secs2, (unsigned long) nsecs2);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting lock contention benchmark...\n");
+	kprintf("%d threads, %d acquires each\n", LB_NTHREADS, LB_NLOOPS);
+
+	lb_round(0);
+	lb_round(1);
+
+	kprintf("Lock contention benchmark done\n");
+
+	return 0;
+}
+
+/*
+ * Reader-writer lock stress test.
+ *
+ * A crowd of readers and a few writers hammer on one rwlock, all of
+ * them yielding while they hold it so that everyone else gets a go at
+ * it meanwhile. Writers bump testval1 and testval2 with a yield in
+ * between; any reader or writer that sees them differ, or sees a
+ * reader and writer (or two writers) in at once, fails the test. At
+ * the end we report how many readers held the lock at the same time;
+ * with a plain lock that would be 1.
+ */
+
+#define RW_NREADERS  16
+#define RW_NWRITERS  3
+#define RW_NLOOPS    40
+
+static volatile int rw_inreaders;
+static volatile int rw_inwriters;
+static volatile int rw_maxreaders;
+static volatile unsigned long rw_nreads;
+
+/*
+ * Other threads may be asleep on testrw in either mode, so there's no
+ * backing out cleanly the way fail() does for the lock test.
+ */
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	panic("rwtest: thread %lu: %s\n", num, msg);
+}
+
+static
+void
+rwreaderthread(void *junk, unsigned long num)
+{
+	int i, spl;
+
+	(void)junk;
+
+	for (i=0; i<RW_NLOOPS; i++) {
+		rwlock_acquire_read(testrw);
+
+		spl = splhigh();
+		rw_inreaders++;
+		if (rw_inreaders > rw_maxreaders) {
+			rw_maxreaders = rw_inreaders;
+		}
+		rw_nreads++;
+		splx(spl);
+
+		if (rw_inwriters != 0) {
+			rwfail(num, "writer in with readers");
+		}
+		if (testval1 != testval2) {
+			rwfail(num, "saw a write half done");
+		}
+		thread_yield();
+		if (rw_inwriters != 0) {
+			rwfail(num, "writer in with readers");
+		}
+
+		spl = splhigh();
+		rw_inreaders--;
+		splx(spl);
+
+		rwlock_release_read(testrw);
+	}
+
+	V(donesem);
+}
+
+static
+void
+rwwriterthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<RW_NLOOPS; i++) {
+		rwlock_acquire_write(testrw);
+		assert(rwlock_do_i_write(testrw));
+
+		rw_inwriters++;
+		if (rw_inwriters != 1 || rw_inreaders != 0) {
+			rwfail(num, "writer not alone");
+		}
+		testval1++;
+		thread_yield();
+		testval2++;
+		if (testval1 != testval2 || rw_inwriters != 1 ||
+		    rw_inreaders != 0) {
+			rwfail(num, "writer not alone");
+		}
+		rw_inwriters--;
+
+		rwlock_release_write(testrw);
+		thread_yield();
+	}
+
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+	kprintf("%d readers, %d writers, %d acquires each\n",
+		RW_NREADERS, RW_NWRITERS, RW_NLOOPS);
+
+	testval1 = testval2 = 0;
+	rw_inreaders = rw_inwriters = rw_maxreaders = 0;
+	rw_nreads = 0;
+
+	for (i=0; i<RW_NREADERS + RW_NWRITERS; i++) {
+		/* Spread the writers out among the readers. */
+		if (i % (RW_NREADERS / RW_NWRITERS + 1) == 1) {
+			result = thread_fork("rwwriter", NULL, i,
+					     rwwriterthread, NULL);
+		}
+		else {
+			result = thread_fork("rwreader", NULL, i,
+					     rwreaderthread, NULL);
+		}
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<RW_NREADERS + RW_NWRITERS; i++) {
+		P(donesem);
+	}
+
+	kprintf("%lu reads, %lu writes, up to %d readers at once\n",
+		rw_nreads, testval1, rw_maxreaders);
+	if (rw_maxreaders < 2) {
+		kprintf("rwtest: readers never overlapped\n");
+	}
+	kprintf("Rwlock test done\n");
+
+	return 0;
+}
+
+/*
+ * Try and timeout variants.
+ *
+ * Each of lock_acquire_timeout, P_timeout and cv_timedwait is run
+ * once with nobody to let it through, when it must give up with
+ * ETIMEDOUT after about the right number of ticks, and once with a
+ * helper thread that lets it through after TT_SHORT ticks, well
+ * within its time.
+ *
+ * P_timeout and cv_timedwait are then run once more with a V or
+ * signal that comes from a timer due on the same tick as the
+ * waiter's own, and queued after it: it lands after the waiter has
+ * timed out but before the waiter has had a chance to run. Nobody is
+ * left waiting by then, so it must not wake anyone, and the waiter
+ * counts must come out at 0.
+ */
+
+#define TT_SHORT   2
+#define TT_WAIT    5
+#define TT_LONG    HZ
+
+static struct semaphore *ttsem;
+
+static
+void
+tt_expect(const char *what, int result, int expected)
+{
+	if (result != expected) {
+		kprintf("timedtest: %s returned %s, expected %s\n", what,
+			result ? strerror(result) : "0",
+			expected ? strerror(expected) : "0");
+		panic("timedtest failed\n");
+	}
+}
+
+/*
+ * Check that a call timed out, and not too soon.
+ */
+static
+void
+tt_timed(const char *what, int result, u_int32_t start)
+{
+	u_int32_t waited = timeout_ticks() - start;
+
+	tt_expect(what, result, ETIMEDOUT);
+	if (waited < TT_WAIT) {
+		kprintf("timedtest: %s gave up after %lu ticks, expected %d\n",
+			what, (unsigned long) waited, TT_WAIT);
+		panic("timedtest failed\n");
+	}
+	kprintf("%s: timed out after %lu ticks\n", what,
+		(unsigned long) waited);
+}
+
+/* Try for testlock while the main thread holds it. */
+static
+void
+tt_lockwaiter(void *junk, unsigned long num)
+{
+	u_int32_t start;
+
+	(void)junk;
+	(void)num;
+
+	tt_expect("lock_tryacquire", lock_tryacquire(testlock), EAGAIN);
+	start = timeout_ticks();
+	tt_timed("lock_acquire_timeout",
+		 lock_acquire_timeout(testlock, TT_WAIT), start);
+	V(donesem);
+}
+
+/* Hold testlock for a little while. */
+static
+void
+tt_lockholder(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	lock_acquire(testlock);
+	V(donesem);
+	thread_sleep_ticks(TT_SHORT);
+	lock_release(testlock);
+}
+
+/* V ttsem after a little while. */
+static
+void
+tt_poster(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_sleep_ticks(TT_SHORT);
+	V(ttsem);
+}
+
+/* Signal testcv after a little while. */
+static
+void
+tt_signaller(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_sleep_ticks(TT_SHORT);
+	lock_acquire(testlock);
+	cv_signal(testcv, testlock);
+	lock_release(testlock);
+}
+
+/* Tick the main thread's timed wait is due to run out on. */
+static volatile u_int32_t tt_deadline;
+
+/* Timer callbacks for tt_late. */
+static
+void
+tt_latev(void *junk)
+{
+	(void)junk;
+	V(ttsem);
+}
+
+static
+void
+tt_latesignal(void *junk)
+{
+	(void)junk;
+	cv_signal(testcv, testlock);
+}
+
+/*
+ * Once the main thread is asleep in P_timeout (NUM 0) or cv_timedwait
+ * (NUM 1), set a timer to go off right after its own, on tt_deadline,
+ * that V's ttsem or signals testcv as if from another thread that got
+ * in just then.
+ */
+static
+void
+tt_late(void *junk, unsigned long num)
+{
+	struct timeout to;
+	int spl;
+
+	(void)junk;
+
+	spl = splhigh();
+	while ((num==0 ? ttsem->waiters : testcv->cv_nwaiters) == 0) {
+		splx(spl);
+		thread_yield();
+		spl = splhigh();
+	}
+	timeout_add(&to, (int)(tt_deadline - timeout_ticks()),
+		    num==0 ? tt_latev : tt_latesignal, NULL);
+	splx(spl);
+
+	thread_sleep_ticks(TT_WAIT + 1);
+	if (timeout_del(&to)) {
+		panic("timedtest: late timer never went off\n");
+	}
+	V(donesem);
+}
+
+static
+void
+tt_forknum(void (*func)(void *, unsigned long), unsigned long num)
+{
+	int result;
+
+	result = thread_fork("timedtest", NULL, num, func, NULL);
+	if (result) {
+		panic("timedtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+static
+void
+tt_fork(void (*func)(void *, unsigned long))
+{
+	tt_forknum(func, 0);
+}
+
+int
+timedtest(int nargs, char **args)
+{
+	u_int32_t start;
+	int spl, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (ttsem==NULL) {
+		ttsem = sem_create("ttsem", 0);
+		if (ttsem == NULL) {
+			panic("timedtest: sem_create failed\n");
+		}
+	}
+	kprintf("Starting timed wait test...\n");
+
+	/* Locks */
+	tt_expect("lock_tryacquire", lock_tryacquire(testlock), 0);
+	tt_fork(tt_lockwaiter);
+	P(donesem);
+	lock_release(testlock);
+
+	tt_fork(tt_lockholder);
+	P(donesem);
+	tt_expect("lock_acquire_timeout",
+		  lock_acquire_timeout(testlock, TT_LONG), 0);
+	lock_release(testlock);
+
+	/* Semaphores */
+	tt_expect("P_try", P_try(ttsem), EAGAIN);
+	start = timeout_ticks();
+	tt_timed("P_timeout", P_timeout(ttsem, TT_WAIT), start);
+
+	tt_fork(tt_poster);
+	tt_expect("P_timeout", P_timeout(ttsem, TT_LONG), 0);
+	V(ttsem);
+	tt_expect("P_try", P_try(ttsem), 0);
+
+	/*
+	 * V just after timing out. The permit is there by the time we
+	 * get to run, so we take it after all; but the V must not have
+	 * counted us as a sleeper it woke.
+	 */
+	tt_forknum(tt_late, 0);
+	spl = splhigh();
+	tt_deadline = timeout_ticks() + TT_WAIT;
+	result = P_timeout(ttsem, TT_WAIT);
+	splx(spl);
+	P(donesem);
+	tt_expect("P_timeout", result, 0);
+	tt_expect("P_try", P_try(ttsem), EAGAIN);
+	if (ttsem->waiters != 0) {
+		panic("timedtest: %d semaphore waiters left after a late V\n",
+		      ttsem->waiters);
+	}
+
+	/* CVs */
+	lock_acquire(testlock);
+	start = timeout_ticks();
+	tt_timed("cv_timedwait", cv_timedwait(testcv, testlock, TT_WAIT),
+		 start);
+	assert(lock_do_i_hold(testlock));
+
+	tt_fork(tt_signaller);
+	tt_expect("cv_timedwait", cv_timedwait(testcv, testlock, TT_LONG), 0);
+	assert(lock_do_i_hold(testlock));
+
+	/* Signal just after timing out; it must find nobody to wake. */
+	tt_forknum(tt_late, 1);
+	spl = splhigh();
+	tt_deadline = timeout_ticks() + TT_WAIT;
+	result = cv_timedwait(testcv, testlock, TT_WAIT);
+	splx(spl);
+	P(donesem);
+	tt_expect("cv_timedwait", result, ETIMEDOUT);
+	if (testcv->cv_nwaiters != 0) {
+		panic("timedtest: %d cv waiters left after a late signal\n",
+		      testcv->cv_nwaiters);
+	}
+	lock_release(testlock);
+
+	kprintf("Timed wait test done\n");
+	return 0;
+}
+
+/*
+ * Barrier and wait group test.
+ *
+ * BW_NTHREADS threads go through BW_NROUNDS rounds of a barrier. Each
+ * round they all check in, meet at the barrier, and check that everyone
+ * checked in before anyone got past; exactly one of them per round
+ * should be told it was last. Then the same threads are run under a
+ * wait group, with two threads waiting on it at once.
+ */
+
+#define BW_NTHREADS  8
+#define BW_NROUNDS   10
+
+static struct barrier *testbarrier;
+static struct waitgroup *testwg;
+static volatile int bw_checkedin[BW_NROUNDS];
+static volatile int bw_nlast;
+
+static
+void
+bw_inititems(void)
+{
+	inititems();
+	if (testbarrier==NULL) {
+		testbarrier = barrier_create("testbarrier", BW_NTHREADS);
+		if (testbarrier == NULL) {
+			panic("synchtest: barrier_create failed\n");
+		}
+	}
+	if (testwg==NULL) {
+		testwg = waitgroup_create("testwg");
+		if (testwg == NULL) {
+			panic("synchtest: waitgroup_create failed\n");
+		}
+	}
+}
+
+static
+void
+bw_fork(const char *name, void (*func)(void *, unsigned long),
+	unsigned long num)
+{
+	int result;
+
+	result = thread_fork(name, NULL, num, func, NULL);
+	if (result) {
+		panic("synchtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+static
+void
+barrierthread(void *junk, unsigned long num)
+{
+	int round, i, spl;
+
+	(void)junk;
+
+	for (round=0; round<BW_NROUNDS; round++) {
+		/* Arrive at different times. */
+		for (i=0; i<(int)((num + round) % 4); i++) {
+			thread_yield();
+		}
+
+		spl = splhigh();
+		bw_checkedin[round]++;
+		splx(spl);
+
+		if (barrier_wait(testbarrier)) {
+			spl = splhigh();
+			bw_nlast++;
+			splx(spl);
+		}
+
+		if (bw_checkedin[round] != BW_NTHREADS) {
+			panic("bwtest: thread %lu got past round %d with "
+			      "%d of %d in\n", num, round,
+			      bw_checkedin[round], BW_NTHREADS);
+		}
+	}
+
+	V(donesem);
+}
+
+static
+void
+wgworkerthread(void *junk, unsigned long num)
+{
+	unsigned long i;
+	int spl;
+
+	(void)junk;
+
+	for (i=0; i<num % 4; i++) {
+		thread_yield();
+	}
+	spl = splhigh();
+	testval1++;
+	splx(spl);
+
+	waitgroup_done(testwg);
+}
+
+static
+void
+wgwaiterthread(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	waitgroup_wait(testwg);
+	if (testval1 != BW_NTHREADS) {
+		panic("bwtest: waiter %lu woke with %lu of %d done\n",
+		      num, testval1, BW_NTHREADS);
+	}
+	V(donesem);
+}
+
+int
+bwtest(int nargs, char **args)
+{
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	bw_inititems();
+	kprintf("Starting barrier and wait group test...\n");
+
+	for (i=0; i<BW_NROUNDS; i++) {
+		bw_checkedin[i] = 0;
+	}
+	bw_nlast = 0;
+
+	for (i=0; i<BW_NTHREADS; i++) {
+		bw_fork("barriertest", barrierthread, i);
+	}
+	for (i=0; i<BW_NTHREADS; i++) {
+		P(donesem);
+	}
+	if (bw_nlast != BW_NROUNDS) {
+		panic("bwtest: %d threads told they were last in %d rounds\n",
+		      bw_nlast, BW_NROUNDS);
+	}
+	kprintf("Barrier: %d threads, %d rounds ok\n", BW_NTHREADS,
+		BW_NROUNDS);
+
+	testval1 = 0;
+	waitgroup_add(testwg, BW_NTHREADS);
+	bw_fork("wgwaiter", wgwaiterthread, 0);
+	for (i=0; i<BW_NTHREADS; i++) {
+		bw_fork("wgworker", wgworkerthread, i);
+	}
+	waitgroup_wait(testwg);
+	if (testval1 != BW_NTHREADS) {
+		panic("bwtest: waitgroup_wait returned with %lu of %d done\n",
+		      testval1, BW_NTHREADS);
+	}
+	P(donesem);
+	kprintf("Wait group: %d threads, 2 waiters ok\n", BW_NTHREADS);
+
+	kprintf("Barrier and wait group test done\n");
+	return 0;
+}
+
+/*
+ * Completion benchmark.
+ *
+ * Compares the wait group and barrier with the usual ways of doing
+ * the same thing with semaphores:
+ *
+ *   - waiting for CB_NTHREADS threads to finish, by P'ing a semaphore
+ *     once per thread, or with one waitgroup_wait. We count how many
+ *     times the waiting thread is switched out.
+ *
+ *   - CB_NTHREADS threads going through CB_NROUNDS rounds of a
+ *     barrier, either the reusable two-turnstile semaphore barrier or
+ *     a struct barrier. We count everyone's context switches.
+ */
+
+#define CB_NTHREADS  16
+#define CB_NROUNDS   50
+
+/* For the semaphore barrier. */
+static struct semaphore *cb_mutex, *cb_turnstile1, *cb_turnstile2;
+static volatile int cb_count;
+
+static struct barrier *cb_barrier;
+
+static
+void
+cb_worker(void *junk, unsigned long usewg)
+{
+	(void)junk;
+
+	thread_yield();
+	if (usewg) {
+		waitgroup_done(testwg);
+	}
+	else {
+		V(donesem);
+	}
+}
+
+static
+void
+cb_completions(int usewg)
+{
+	unsigned long before;
+	int i;
+
+	before = curswitches();
+	if (usewg) {
+		waitgroup_add(testwg, CB_NTHREADS);
+	}
+	for (i=0; i<CB_NTHREADS; i++) {
+		bw_fork("cbworker", cb_worker, usewg);
+	}
+	if (usewg) {
+		waitgroup_wait(testwg);
+	}
+	else {
+		for (i=0; i<CB_NTHREADS; i++) {
+			P(donesem);
+		}
+	}
+	kprintf("%s: waiter switched out %lu times for %d threads\n",
+		usewg ? "Wait group " : "Semaphore  ",
+		curswitches() - before, CB_NTHREADS);
+}
+
+/*
+ * Reusable barrier out of semaphores: the last one in opens the first
+ * turnstile for everyone, and the last one out opens the second.
+ */
+static
+void
+cb_sembarrier(void)
+{
+	P(cb_mutex);
+	cb_count++;
+	if (cb_count == CB_NTHREADS) {
+		V_n(cb_turnstile1, CB_NTHREADS);
+	}
+	V(cb_mutex);
+	P(cb_turnstile1);
+
+	P(cb_mutex);
+	cb_count--;
+	if (cb_count == 0) {
+		V_n(cb_turnstile2, CB_NTHREADS);
+	}
+	V(cb_mutex);
+	P(cb_turnstile2);
+}
+
+static
+void
+cb_barrierthread(void *junk, unsigned long usebarrier)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<CB_NROUNDS; i++) {
+		if (usebarrier) {
+			barrier_wait(cb_barrier);
+		}
+		else {
+			cb_sembarrier();
+		}
+	}
+
+	countswitches();
+	V(donesem);
+}
+
+static
+void
+cb_barriers(int usebarrier)
+{
+	int i;
+
+	switches = 0;
+	for (i=0; i<CB_NTHREADS; i++) {
+		bw_fork("cbbarrier", cb_barrierthread, usebarrier);
+	}
+	for (i=0; i<CB_NTHREADS; i++) {
+		P(donesem);
+	}
+	kprintf("%s: %lu switches for %d threads x %d rounds\n",
+		usebarrier ? "Barrier    " : "Sem barrier",
+		switches, CB_NTHREADS, CB_NROUNDS);
+}
+
+int
+completionbench(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	bw_inititems();
+	if (cb_barrier==NULL) {
+		cb_barrier = barrier_create("cb_barrier", CB_NTHREADS);
+		cb_mutex = sem_create("cb_mutex", 1);
+		cb_turnstile1 = sem_create("cb_turnstile1", 0);
+		cb_turnstile2 = sem_create("cb_turnstile2", 0);
+		if (cb_barrier == NULL || cb_mutex == NULL ||
+		    cb_turnstile1 == NULL || cb_turnstile2 == NULL) {
+			panic("completionbench: out of memory\n");
+		}
+	}
+	cb_count = 0;
+
+	kprintf("Starting completion benchmark...\n");
+	cb_completions(0);
+	cb_completions(1);
+	cb_barriers(0);
+	cb_barriers(1);
+	kprintf("Completion benchmark done\n");
+
+	return 0;
+}
@@ -31,7 +31,8 @@ static const char waitaddrs[NWAITADDRS];  /* N distinct wait addresses */
 
 static volatile int wakerdone;
 static struct semaphore *wakersem;
-static struct semaphore *donesem;
+static struct waitgroup *workwg;	/* sleepalot and compute threads */
+static struct waitgroup *wakerwg;	/* the waker */
 
 static
 void
@@ -40,8 +41,11 @@ setup(void)
 	if (wakersem == NULL) {
 		wakersem = sem_create("wakersem", 1);
 	}
-	if (donesem == NULL) {
-		donesem = sem_create("donesem", 0);
+	if (workwg == NULL) {
+		workwg = waitgroup_create("workwg");
+	}
+	if (wakerwg == NULL) {
+		wakerwg = waitgroup_create("wakerwg");
 	}
 	wakerdone = 0;
 }
@@ -62,7 +66,7 @@ sleepalot_thread(void *junk, unsigned long num)
 		}
 		kprintf("[%lu]", num);
 	}
-	V(donesem);
+	waitgroup_done(workwg);
 }
 
 static
@@ -90,7 +94,7 @@ waker_thread(void *junk1, unsigned long junk2)
 			thread_yield();
 		}
 	}
-	V(donesem);
+	waitgroup_done(wakerwg);
 }
 
 static
@@ -167,7 +171,7 @@ compute_thread(void *junk1, unsigned long num)
 	kfree(m2);
 	kfree(m3);
 
-	V(donesem);
+	waitgroup_done(workwg);
 }
 
 static
@@ -188,16 +192,13 @@ make_computes(int howmany)
 
 static
 void
-finish(int howmanytotal)
+finish(void)
 {
-	int i;
-	for (i=0; i<howmanytotal; i++) {
-		P(donesem);
-	}
+	waitgroup_wait(workwg);
 	P(wakersem);
 	wakerdone = 1;
 	V(wakersem);
-	P(donesem);
+	waitgroup_wait(wakerwg);
 }
 
 static
@@ -208,9 +209,11 @@ runtest3(int nsleeps, int ncomputes)
 	kprintf("Starting thread test 3 (%d [sleepalots], %d {computes}, "
 		"1 waker)\n",
 		nsleeps, ncomputes);
+	waitgroup_add(workwg, nsleeps+ncomputes);
+	waitgroup_add(wakerwg, 1);
 	make_sleepalots(nsleeps);
 	make_computes(ncomputes);
-	finish(nsleeps+ncomputes);
+	finish();
 	kprintf("\nThread test 3 done\n");
 }
 
@@ -2,15 +2,58 @@
 #include <lib.h>
 #include <machine/spl.h>
 #include <thread.h>
+#include <curthread.h>
+#include <scheduler.h>
 #include <clock.h>
+#include <timeout.h>
 
-/* 
+/*
  * The address of lbolt has thread_wakeup called on it once a second.
  */
 int lbolt;
 
 static int lbolt_counter;
 
+/*
+ * Tickless idle.
+ *
+ * When there's nothing to run, instead of taking an interrupt every
+ * tick we ask the timer driver to stay quiet until the next thing
+ * that actually needs doing (the next lbolt or timeout). When the
+ * idle loop wakes up again, we work out from the realtime clock how
+ * many ticks went by and run them all at once.
+ *
+ * hardclock_tickless can be turned off from the menu.
+ */
+int hardclock_tickless = 1;
+
+/* Driver hook for changing the tick interval; NULL if not supported. */
+static void (*timer_setticks)(void *devdata, int ticks);
+static void *timer_devdata;
+
+/* Nonzero while the timer is reprogrammed for a long idle tick. */
+static int idle_armed;
+
+/* Set if the long idle tick actually went off. */
+static int idle_fired;
+
+/*
+ * Timekeeping done on every tick, whether or not anything is
+ * running.
+ */
+static
+void
+hardclock_tick(void)
+{
+	lbolt_counter++;
+	if (lbolt_counter >= HZ) {
+		lbolt_counter = 0;
+		thread_wakeup(&lbolt);
+	}
+
+	timeout_tick();
+}
+
 /*
  * This is called HZ times a second by the timer device setup.
  */
@@ -22,14 +65,99 @@ hardclock(void)
 	 * Collect statistics here as desired.
 	 */
 
+	if (idle_armed) {
+		/* Long idle tick; hardclock_idle accounts for it. */
+		idle_fired = 1;
+		return;
+	}
 
-	lbolt_counter++;
-	if (lbolt_counter >= HZ) {
-		lbolt_counter = 0;
-		thread_wakeup(&lbolt);
+	hardclock_tick();
+
+	if (curthread != NULL) {
+		curthread->t_rusage.ru_ticks++;
+	}
+
+	/* Preempt only when the scheduler says the quantum is up. */
+	if (scheduler_tick()) {
+		thread_yield();
+	}
+}
+
+/*
+ * Called by the driver for the timer that calls hardclock, if it can
+ * change how many ticks pass between interrupts.
+ */
+void
+hardclock_register_timer(void (*setticks)(void *devdata, int ticks),
+			 void *devdata)
+{
+	timer_setticks = setticks;
+	timer_devdata = devdata;
+}
+
+/*
+ * Number of ticks from now until hardclock next has real work to do.
+ */
+static
+int
+hardclock_nextevent(void)
+{
+	return timeout_nextevent(HZ - lbolt_counter);
+}
+
+/*
+ * Idle the processor until something happens. Called by the
+ * scheduler, with interrupts off, in place of cpu_idle().
+ */
+void
+hardclock_idle(void)
+{
+	time_t secs1, secs2;
+	u_int32_t nsecs1, nsecs2;
+	u_int32_t usecs;
+	int ticks, elapsed;
+
+	assert(curspl>0);
+
+	ticks = hardclock_nextevent();
+	if (!hardclock_tickless || timer_setticks == NULL || ticks <= 1) {
+		cpu_idle();
+		return;
+	}
+
+	gettime(&secs1, &nsecs1);
+	idle_fired = 0;
+	idle_armed = 1;
+	timer_setticks(timer_devdata, ticks);
+
+	cpu_idle();
+
+	timer_setticks(timer_devdata, 1);
+	idle_armed = 0;
+	gettime(&secs2, &nsecs2);
+
+	/*
+	 * Work out how many whole ticks went by and catch up on them.
+	 * If something other than the timer woke us, the rest of the
+	 * partial tick is lost; that's a small drift in lbolt at worst.
+	 */
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
+	if (idle_fired || secs2 > 0) {
+		elapsed = ticks;
+	}
+	else {
+		usecs = nsecs2 / 1000;
+		elapsed = usecs / (1000000 / HZ);
+		if (elapsed > ticks) {
+			elapsed = ticks;
+		}
 	}
 
-	thread_yield();
+	while (elapsed-- > 0) {
+		hardclock_tick();
+		/* Nothing is running, so this never asks for a yield. */
+		scheduler_tick();
+	}
 }
 
 /*
@@ -0,0 +1,215 @@
+/*
+ * Lock contention statistics. See lockstat.h.
+ *
+ * Times are kept in microseconds from the realtime clock. Individual
+ * waits and holds are worked out in 32 bits, which is good for about
+ * an hour; the totals are kept as seconds and microseconds.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <clock.h>
+#include <synch.h>
+#include <lockstat.h>
+
+/* All live locks. */
+static struct lock *alllocks;
+
+/* Most locks lockstat_print will list. */
+#define LOCKSTAT_MAXPRINT 32
+
+void
+lockstat_register(struct lock *lock)
+{
+	struct lockstat *ls = &lock->lk_stat;
+	int spl;
+
+	bzero(ls, sizeof(*ls));
+
+	spl = splhigh();
+	ls->ls_next = alllocks;
+	if (alllocks != NULL) {
+		alllocks->lk_stat.ls_prevp = &ls->ls_next;
+	}
+	ls->ls_prevp = &alllocks;
+	alllocks = lock;
+	splx(spl);
+}
+
+void
+lockstat_unregister(struct lock *lock)
+{
+	struct lockstat *ls = &lock->lk_stat;
+	int spl;
+
+	spl = splhigh();
+	*ls->ls_prevp = ls->ls_next;
+	if (ls->ls_next != NULL) {
+		ls->ls_next->lk_stat.ls_prevp = ls->ls_prevp;
+	}
+	ls->ls_next = NULL;
+	ls->ls_prevp = NULL;
+	splx(spl);
+}
+
+u_int32_t
+lockstat_now(void)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	gettime_early(&secs, &nsecs);
+	return secs * 1000000 + nsecs / 1000;
+}
+
+/*
+ * Add USECS to the total SECS/TUSECS.
+ */
+static
+void
+lockstat_addtime(time_t *secs, u_int32_t *tusecs, u_int32_t usecs)
+{
+	*secs += usecs / 1000000;
+	*tusecs += usecs % 1000000;
+	if (*tusecs >= 1000000) {
+		*tusecs -= 1000000;
+		(*secs)++;
+	}
+}
+
+void
+lockstat_acquired(struct lock *lock)
+{
+	struct lockstat *ls = &lock->lk_stat;
+
+	assert(curspl>0);
+
+	ls->ls_acquires++;
+	ls->ls_stamp = lockstat_now();
+}
+
+void
+lockstat_released(struct lock *lock)
+{
+	struct lockstat *ls = &lock->lk_stat;
+	u_int32_t held;
+
+	assert(curspl>0);
+
+	held = lockstat_now() - ls->ls_stamp;
+	lockstat_addtime(&ls->ls_holdsecs, &ls->ls_holdusecs, held);
+	if (held > ls->ls_maxhold) {
+		ls->ls_maxhold = held;
+	}
+}
+
+void
+lockstat_waited(struct lock *lock, u_int32_t start)
+{
+	struct lockstat *ls = &lock->lk_stat;
+	u_int32_t waited;
+
+	assert(curspl>0);
+
+	waited = lockstat_now() - start;
+	ls->ls_contended++;
+	lockstat_addtime(&ls->ls_waitsecs, &ls->ls_waitusecs, waited);
+	if (waited > ls->ls_maxwait) {
+		ls->ls_maxwait = waited;
+	}
+}
+
+/*
+ * Nonzero if A has more total wait than B.
+ */
+static
+int
+lockstat_morewait(struct lock *a, struct lock *b)
+{
+	struct lockstat *la = &a->lk_stat, *lb = &b->lk_stat;
+
+	if (la->ls_waitsecs != lb->ls_waitsecs) {
+		return la->ls_waitsecs > lb->ls_waitsecs;
+	}
+	return la->ls_waitusecs > lb->ls_waitusecs;
+}
+
+void
+lockstat_print(int n)
+{
+	struct lock *top[LOCKSTAT_MAXPRINT], *l;
+	struct lockstat *ls;
+	int i, j, ntop = 0, nlocks = 0, spl;
+
+	if (n > LOCKSTAT_MAXPRINT) {
+		n = LOCKSTAT_MAXPRINT;
+	}
+
+	/* print the whole thing with interrupts off */
+	spl = splhigh();
+
+	/* Keep the N worst so far, worst first. */
+	for (l = alllocks; l != NULL; l = l->lk_stat.ls_next) {
+		nlocks++;
+		if (l->lk_stat.ls_acquires == 0) {
+			continue;
+		}
+		for (i = ntop; i > 0 && lockstat_morewait(l, top[i-1]); i--) {
+			/* nothing */
+		}
+		if (i >= n) {
+			continue;
+		}
+		if (ntop < n) {
+			ntop++;
+		}
+		for (j = ntop-1; j > i; j--) {
+			top[j] = top[j-1];
+		}
+		top[i] = l;
+	}
+
+	kprintf("%d locks; top %d by wait time (times in usecs):\n",
+		nlocks, ntop);
+	kprintf("%-16s %8s %8s %14s %9s %14s %9s\n", "lock", "acquires",
+		"waits", "total wait", "max wait", "total hold", "max hold");
+	for (i=0; i<ntop; i++) {
+		ls = &top[i]->lk_stat;
+		kprintf("%-16s %8lu %8lu %7lu.%06lu %9lu %7lu.%06lu %9lu\n",
+			top[i]->name,
+			(unsigned long) ls->ls_acquires,
+			(unsigned long) ls->ls_contended,
+			(unsigned long) ls->ls_waitsecs,
+			(unsigned long) ls->ls_waitusecs,
+			(unsigned long) ls->ls_maxwait,
+			(unsigned long) ls->ls_holdsecs,
+			(unsigned long) ls->ls_holdusecs,
+			(unsigned long) ls->ls_maxhold);
+	}
+
+	splx(spl);
+}
+
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+	struct lock *l;
+	int spl;
+
+	spl = splhigh();
+	for (l = alllocks; l != NULL; l = l->lk_stat.ls_next) {
+		ls = &l->lk_stat;
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waitsecs = 0;
+		ls->ls_waitusecs = 0;
+		ls->ls_maxwait = 0;
+		ls->ls_holdsecs = 0;
+		ls->ls_holdusecs = 0;
+		ls->ls_maxhold = 0;
+		/* ls_stamp stays, for locks held right now */
+	}
+	splx(spl);
+}
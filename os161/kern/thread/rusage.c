@@ -0,0 +1,205 @@
+/*
+ * Thread and process CPU accounting.
+ *
+ * Time is measured with the realtime clock, so it's good to well
+ * under a tick. Early in boot, before the clock is attached, threads
+ * get a zero timestamp and the first interval after that is dropped.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <clock.h>
+#include <thread.h>
+#include <curthread.h>
+#include <rusage.h>
+
+/*
+ * Add the time from S1/NS1 to S2/NS2 to SECS/USECS.
+ */
+static
+void
+rusage_addtime(time_t *secs, u_int32_t *usecs,
+	       time_t s1, u_int32_t ns1, time_t s2, u_int32_t ns2)
+{
+	time_t ds;
+	u_int32_t dns;
+
+	if (s1 == 0 && ns1 == 0) {
+		/* Stamped before the clock was there. */
+		return;
+	}
+
+	getinterval(s1, ns1, s2, ns2, &ds, &dns);
+	*secs += ds;
+	*usecs += dns / 1000;
+	if (*usecs >= 1000000) {
+		*usecs -= 1000000;
+		(*secs)++;
+	}
+}
+
+void
+rusage_stamp(struct thread *t)
+{
+	gettime_early(&t->t_stampsecs, &t->t_stampnsecs);
+}
+
+void
+rusage_chargerun(struct thread *t)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	gettime_early(&secs, &nsecs);
+	rusage_addtime(&t->t_rusage.ru_runsecs, &t->t_rusage.ru_runusecs,
+		       t->t_stampsecs, t->t_stampnsecs, secs, nsecs);
+	t->t_stampsecs = secs;
+	t->t_stampnsecs = nsecs;
+}
+
+u_int32_t
+rusage_chargewait(struct thread *t)
+{
+	time_t secs, waitsecs = 0;
+	u_int32_t nsecs, waitusecs = 0;
+
+	gettime_early(&secs, &nsecs);
+	rusage_addtime(&waitsecs, &waitusecs,
+		       t->t_stampsecs, t->t_stampnsecs, secs, nsecs);
+	t->t_stampsecs = secs;
+	t->t_stampnsecs = nsecs;
+
+	t->t_rusage.ru_waitsecs += waitsecs;
+	t->t_rusage.ru_waitusecs += waitusecs;
+	if (t->t_rusage.ru_waitusecs >= 1000000) {
+		t->t_rusage.ru_waitusecs -= 1000000;
+		t->t_rusage.ru_waitsecs++;
+	}
+
+	if (waitsecs >= 4000) {
+		return 0xffffffff;
+	}
+	return waitsecs * 1000000 + waitusecs;
+}
+
+void
+rusage_add(struct rusage *to, const struct rusage *from)
+{
+	to->ru_runsecs += from->ru_runsecs;
+	to->ru_runusecs += from->ru_runusecs;
+	if (to->ru_runusecs >= 1000000) {
+		to->ru_runusecs -= 1000000;
+		to->ru_runsecs++;
+	}
+
+	to->ru_waitsecs += from->ru_waitsecs;
+	to->ru_waitusecs += from->ru_waitusecs;
+	if (to->ru_waitusecs >= 1000000) {
+		to->ru_waitusecs -= 1000000;
+		to->ru_waitsecs++;
+	}
+
+	to->ru_ticks += from->ru_ticks;
+	to->ru_nvcsw += from->ru_nvcsw;
+	to->ru_nivcsw += from->ru_nivcsw;
+	to->ru_nfaults += from->ru_nfaults;
+}
+
+void
+thread_getrusage(struct thread *t, struct rusage *ru)
+{
+	time_t secs;
+	u_int32_t nsecs;
+	int spl;
+
+	spl = splhigh();
+
+	*ru = t->t_rusage;
+	if (t == curthread) {
+		/* Count the run we're in the middle of. */
+		gettime_early(&secs, &nsecs);
+		rusage_addtime(&ru->ru_runsecs, &ru->ru_runusecs,
+			       t->t_stampsecs, t->t_stampnsecs, secs, nsecs);
+	}
+
+	splx(spl);
+}
+
+int
+pcb_getrusage(int pid, struct rusage *ru)
+{
+	struct rusage tru;
+	int spl;
+
+	if (pid < MIN_PID || pid >= MAX_PID) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+
+	if (PCBs[pid] == NULL) {
+		splx(spl);
+		return EINVAL;
+	}
+
+	*ru = PCBs[pid]->p_rusage;
+	if (!PCBs[pid]->exited && PCBs[pid]->this_thread != NULL) {
+		thread_getrusage(PCBs[pid]->this_thread, &tru);
+		rusage_add(ru, &tru);
+	}
+
+	splx(spl);
+	return 0;
+}
+
+/*
+ * Print one line per process.
+ */
+void
+rusage_printall(void)
+{
+	struct rusage ru;
+	const char *name;
+	int pid, spl;
+
+	/* print the whole thing with interrupts off */
+	spl = splhigh();
+
+	kprintf("  PID PPID PRI         RUN        WAIT  TICKS   VCSW  IVCSW"
+		" FAULTS NAME\n");
+	for (pid = MIN_PID; pid < MAX_PID; pid++) {
+		if (PCBs[pid] == NULL) {
+			continue;
+		}
+		pcb_getrusage(pid, &ru);
+
+		if (PCBs[pid]->exited || PCBs[pid]->this_thread == NULL) {
+			name = "<exited>";
+		}
+		else {
+			name = PCBs[pid]->this_thread->t_name;
+		}
+
+		kprintf("%5d %4d ", pid, PCBs[pid]->parent);
+		if (PCBs[pid]->exited || PCBs[pid]->this_thread == NULL) {
+			kprintf("  -");
+		}
+		else {
+			kprintf("%3d", PCBs[pid]->this_thread->t_priority);
+		}
+		kprintf(" %4lu.%06lu %4lu.%06lu %6lu %6lu %6lu %6lu %s\n",
+			(unsigned long) ru.ru_runsecs,
+			(unsigned long) ru.ru_runusecs,
+			(unsigned long) ru.ru_waitsecs,
+			(unsigned long) ru.ru_waitusecs,
+			(unsigned long) ru.ru_ticks,
+			(unsigned long) ru.ru_nvcsw,
+			(unsigned long) ru.ru_nivcsw,
+			(unsigned long) ru.ru_nfaults,
+			name);
+	}
+
+	splx(spl);
+}
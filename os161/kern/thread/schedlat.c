@@ -0,0 +1,165 @@
+/*
+ * Scheduling latency histograms.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <schedlat.h>
+
+/* Global histograms: every dispatch, and dispatches after a wakeup. */
+static u_int32_t lat_all[SCHEDLAT_NBUCKETS];
+static u_int32_t lat_wakeup[SCHEDLAT_NBUCKETS];
+
+/*
+ * Which bucket a wait of USECS goes in: floor(log2(usecs)), capped
+ * at the last bucket.
+ */
+static
+int
+schedlat_bucket(u_int32_t usecs)
+{
+	int b = 0;
+
+	while (usecs > 1 && b < SCHEDLAT_NBUCKETS-1) {
+		usecs >>= 1;
+		b++;
+	}
+	return b;
+}
+
+void
+schedlat_record(struct thread *t, u_int32_t usecs)
+{
+	int b;
+
+	assert(curspl>0);
+
+	b = schedlat_bucket(usecs);
+	t->t_lathist[b]++;
+	lat_all[b]++;
+	if (t->t_woken) {
+		lat_wakeup[b]++;
+		t->t_woken = 0;
+	}
+}
+
+/*
+ * Print a histogram, skipping empty buckets at either end.
+ */
+static
+void
+schedlat_printhist(const char *title, const u_int32_t *hist)
+{
+	u_int32_t total = 0, max = 0;
+	int i, first, last, bar;
+
+	first = -1;
+	last = -1;
+	for (i=0; i<SCHEDLAT_NBUCKETS; i++) {
+		total += hist[i];
+		if (hist[i] > max) {
+			max = hist[i];
+		}
+		if (hist[i] > 0) {
+			if (first < 0) {
+				first = i;
+			}
+			last = i;
+		}
+	}
+
+	kprintf("%s (%lu samples):\n", title, (unsigned long) total);
+	if (total == 0) {
+		return;
+	}
+
+	for (i=first; i<=last; i++) {
+		if (i == SCHEDLAT_NBUCKETS-1) {
+			kprintf("  %7lu-    inf us: ", 1UL << i);
+		}
+		else {
+			kprintf("  %7lu-%7lu us: ", i == 0 ? 0UL : 1UL << i,
+				(1UL << (i+1)) - 1);
+		}
+		kprintf("%8lu ", (unsigned long) hist[i]);
+		for (bar = (hist[i] * 30 + max - 1) / max; bar > 0; bar--) {
+			kprintf("*");
+		}
+		kprintf("\n");
+	}
+}
+
+int
+schedlat_print(int pid)
+{
+	u_int32_t hist[SCHEDLAT_NBUCKETS];
+	char title[64];
+	int i, spl;
+
+	if (pid == 0) {
+		/* Copy them out so the print is consistent. */
+		spl = splhigh();
+		for (i=0; i<SCHEDLAT_NBUCKETS; i++) {
+			hist[i] = lat_all[i];
+		}
+		splx(spl);
+		schedlat_printhist("Run queue latency, all dispatches", hist);
+
+		spl = splhigh();
+		for (i=0; i<SCHEDLAT_NBUCKETS; i++) {
+			hist[i] = lat_wakeup[i];
+		}
+		splx(spl);
+		schedlat_printhist("Wakeup-to-run latency", hist);
+		return 0;
+	}
+
+	if (pid < MIN_PID || pid >= MAX_PID) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	if (PCBs[pid] == NULL || PCBs[pid]->exited ||
+	    PCBs[pid]->this_thread == NULL) {
+		splx(spl);
+		return EINVAL;
+	}
+	for (i=0; i<SCHEDLAT_NBUCKETS; i++) {
+		hist[i] = PCBs[pid]->this_thread->t_lathist[i];
+	}
+	snprintf(title, sizeof(title), "Run queue latency, pid %d (%s)",
+		 pid, PCBs[pid]->this_thread->t_name);
+	splx(spl);
+
+	schedlat_printhist(title, hist);
+	return 0;
+}
+
+void
+schedlat_reset(void)
+{
+	struct thread *t;
+	int i, pid, spl;
+
+	spl = splhigh();
+
+	for (i=0; i<SCHEDLAT_NBUCKETS; i++) {
+		lat_all[i] = 0;
+		lat_wakeup[i] = 0;
+	}
+
+	for (pid = MIN_PID; pid < MAX_PID; pid++) {
+		if (PCBs[pid] == NULL || PCBs[pid]->exited) {
+			continue;
+		}
+		t = PCBs[pid]->this_thread;
+		if (t != NULL) {
+			bzero(t->t_lathist, sizeof(t->t_lathist));
+		}
+	}
+
+	splx(spl);
+}
@@ -1,23 +1,214 @@
 /*
  * Scheduler.
  *
- * The default scheduler is very simple, just a round-robin run queue.
- * You'll want to improve it.
+ * Multi-level feedback queue. There are SCHED_NLEVELS run queues;
+ * level 0 is the highest priority. The scheduler always runs the
+ * head of the highest-priority non-empty queue.
+ *
+ *   - A thread that uses up its quantum (checked from hardclock via
+ *     scheduler_tick) is demoted one level. Lower levels get longer
+ *     quanta, so CPU hogs run less often but for longer at a time.
+ *   - A thread that wakes up from thread_sleep is promoted one level
+ *     (scheduler_boost), so interactive and I/O-bound threads stay
+ *     near the top.
+ *   - Every SCHED_AGING_TICKS ticks everything is moved back to the
+ *     top level, so nothing starves.
+ *
+ * scheduler_setpriority sets a thread's base level, which is as high
+ * as it can ever get: promotion and aging stop there instead of at
+ * level 0.
+ *
+ * On top of that, a thread holding a lock that a higher-priority
+ * thread is waiting for inherits the waiter's level (t_inherit; see
+ * lock_acquire). The level a thread is actually scheduled at is the
+ * higher of its own and the inherited one.
+ *
+ * Stride class. A thread given tickets with scheduler_setshare is
+ * taken out of the MLFQ and scheduled by stride scheduling instead:
+ * each gets a share of the processor proportional to its tickets.
+ * Each thread has a stride of STRIDE1/tickets and a pass value that
+ * goes up by its stride for every tick it runs; the runnable thread
+ * with the lowest pass runs next. The stride class is a batch class:
+ * it only runs when all the MLFQ queues are empty, and is treated as
+ * level SCHED_NLEVELS for priority comparisons. A stride thread that
+ * inherits a level through a lock is scheduled in the MLFQ at that
+ * level until it lets go.
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <scheduler.h>
 #include <thread.h>
+#include <curthread.h>
 #include <machine/spl.h>
 #include <queue.h>
+#include <array.h>
+#include <clock.h>
+#include <rusage.h>
+#include <workqueue.h>
+#include <vm.h>
 
 /*
  *  Scheduler data
  */
 
-// Queue of runnable threads
-static struct queue *runqueue;
+// Queues of runnable threads, one per priority level
+static struct queue *runqueues[SCHED_NLEVELS];
+
+// Number of threads on all the run queues
+static int numrunnable;
+
+// Ticks since the last aging pass
+static int aging_counter;
+
+/*
+ * Runnable stride-class threads (unordered; there are never many) and
+ * the pass of the one that was picked last, which is where newly
+ * runnable ones start so they can't bank credit while asleep.
+ */
+static struct array *stridequeue;
+static u_int32_t stride_pass;
+
+/* Wraparound-safe comparison of pass values. */
+#define PASS_BEFORE(a, b)  ((int32_t)((a) - (b)) < 0)
+
+/*
+ * Aging generation. Bumped on every aging pass; a thread whose
+ * t_epoch is stale gets reset to the top level the next time it is
+ * made runnable. This catches sleeping threads (and curthread)
+ * without having to go find them.
+ */
+static int aging_epoch;
+
+/* Work item for the aging pass. */
+static struct work aging_work;
+static void scheduler_age(void *);
+
+/*
+ * Length of the quantum at a given level, in hardclock ticks.
+ * sched_quantum is the top-level time slice; it doubles with each
+ * level down. Set with scheduler_setquantum.
+ */
+static int sched_quantum = 1;
+#define QUANTUM(level)  (sched_quantum << (level))
+
+static
+int
+q_length(struct queue *q)
+{
+	return (q_getend(q) - q_getstart(q) + q_getsize(q)) % q_getsize(q);
+}
+
+/*
+ * Take T out of the middle of queue Q, keeping the others in order.
+ * Returns nonzero if it was there.
+ */
+static
+int
+q_remove(struct queue *q, struct thread *t)
+{
+	struct thread *x;
+	int n, found = 0, result;
+
+	n = q_length(q);
+	while (n-- > 0) {
+		x = q_remhead(q);
+		if (x == t && !found) {
+			found = 1;
+			continue;
+		}
+		/* we just made room, can't fail */
+		result = q_addtail(q, x);
+		assert(result==0);
+	}
+	return found;
+}
+
+/*
+ * The level T is scheduled at, counting inherited priority.
+ */
+int
+scheduler_level(struct thread *t)
+{
+	int level = t->t_tickets > 0 ? SCHED_NLEVELS : t->t_priority;
+
+	return t->t_inherit < level ? t->t_inherit : level;
+}
+
+/*
+ * Put T on the queue for LEVEL (SCHED_NLEVELS is the stride queue).
+ */
+static
+int
+sched_enqueue(struct thread *t, int level)
+{
+	if (level == SCHED_NLEVELS) {
+		if (PASS_BEFORE(t->t_pass, stride_pass)) {
+			t->t_pass = stride_pass;
+		}
+		return array_add(stridequeue, t);
+	}
+	return q_addtail(runqueues[level], t);
+}
+
+/*
+ * Take T off the queue for LEVEL. Returns nonzero if it was there.
+ */
+static
+int
+sched_dequeue(struct thread *t, int level)
+{
+	int i, n, result;
+
+	if (level < SCHED_NLEVELS) {
+		return q_remove(runqueues[level], t);
+	}
+
+	n = array_getnum(stridequeue);
+	for (i=0; i<n; i++) {
+		if (array_getguy(stridequeue, i) == t) {
+			array_setguy(stridequeue, i,
+				     array_getguy(stridequeue, n-1));
+			/* shrinking, can't fail */
+			result = array_setsize(stridequeue, n-1);
+			assert(result==0);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Take the stride thread with the lowest pass off the stride queue.
+ */
+static
+struct thread *
+stride_remmin(void)
+{
+	struct thread *t, *best = NULL;
+	int i, n, besti = 0, result;
+
+	n = array_getnum(stridequeue);
+	for (i=0; i<n; i++) {
+		t = array_getguy(stridequeue, i);
+		if (best == NULL || PASS_BEFORE(t->t_pass, best->t_pass)) {
+			best = t;
+			besti = i;
+		}
+	}
+	if (best == NULL) {
+		return NULL;
+	}
+
+	array_setguy(stridequeue, besti, array_getguy(stridequeue, n-1));
+	/* shrinking, can't fail */
+	result = array_setsize(stridequeue, n-1);
+	assert(result==0);
+
+	stride_pass = best->t_pass;
+	return best;
+}
 
 /*
  * Setup function
@@ -25,24 +216,48 @@ static struct queue *runqueue;
 void
 scheduler_bootstrap(void)
 {
-	runqueue = q_create(32);
-	if (runqueue == NULL) {
-		panic("scheduler: Could not create run queue\n");
+	int i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		runqueues[i] = q_create(32);
+		if (runqueues[i] == NULL) {
+			panic("scheduler: Could not create run queue\n");
+		}
+	}
+	stridequeue = array_create();
+	if (stridequeue == NULL) {
+		panic("scheduler: Could not create stride queue\n");
 	}
+	stride_pass = 0;
+	numrunnable = 0;
+	aging_counter = 0;
+	aging_epoch = 0;
+	work_init(&aging_work, scheduler_age, NULL);
 }
 
 /*
  * Ensure space for handling at least NTHREADS threads.
  * This is done only to ensure that make_runnable() does not fail -
- * if you change the scheduler to not require space outside the 
+ * if you change the scheduler to not require space outside the
  * thread structure, for instance, this function can reasonably
  * do nothing.
+ *
+ * Any thread can end up on any level (aging moves everyone to the
+ * top at once), so every queue needs room for all of them.
  */
 int
 scheduler_preallocate(int nthreads)
 {
+	int i, result;
+
 	assert(curspl>0);
-	return q_preallocate(runqueue, nthreads);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		result = q_preallocate(runqueues[i], nthreads);
+		if (result) {
+			return result;
+		}
+	}
+	return array_preallocate(stridequeue, nthreads);
 }
 
 /*
@@ -54,11 +269,21 @@ scheduler_preallocate(int nthreads)
 void
 scheduler_killall(void)
 {
+	int i;
+
 	assert(curspl>0);
-	while (!q_empty(runqueue)) {
-		struct thread *t = q_remhead(runqueue);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		while (!q_empty(runqueues[i])) {
+			struct thread *t = q_remhead(runqueues[i]);
+			kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+		}
+	}
+	for (i=0; i<array_getnum(stridequeue); i++) {
+		struct thread *t = array_getguy(stridequeue, i);
 		kprintf("scheduler: Dropping thread %s.\n", t->t_name);
 	}
+	array_setsize(stridequeue, 0);
+	numrunnable = 0;
 }
 
 /*
@@ -71,50 +296,360 @@ scheduler_killall(void)
 void
 scheduler_shutdown(void)
 {
+	int i;
+
 	scheduler_killall();
 
 	assert(curspl>0);
-	q_destroy(runqueue);
-	runqueue = NULL;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		q_destroy(runqueues[i]);
+		runqueues[i] = NULL;
+	}
+	array_destroy(stridequeue);
+	stridequeue = NULL;
 }
 
 /*
  * Actual scheduler. Returns the next thread to run.  Calls cpu_idle()
- * if there's nothing ready. (Note: cpu_idle must be called in a loop
+ * (by way of hardclock_idle) if there's nothing ready. (Note: cpu_idle must be called in a loop
  * until something's ready - it doesn't know whether the things that
- * wake it up are going to make a thread runnable or not.) 
+ * wake it up are going to make a thread runnable or not.)
  */
 struct thread *
 scheduler(void)
 {
+	int i;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	while (q_empty(runqueue)) {
-		cpu_idle();
+
+	while (numrunnable == 0) {
+		/*
+		 * Spend idle time zeroing free pages for the fault path,
+		 * one page at a time with a window for interrupts in
+		 * between. Only really idle once that's done.
+		 */
+		if (vm_zero_idle()) {
+			spl0();
+			splhigh();
+			continue;
+		}
+		hardclock_idle();
 	}
 
 	// You can actually uncomment this to see what the scheduler's
 	// doing - even this deep inside thread code, the console
 	// still works. However, the amount of text printed is
 	// prohibitive.
-	// 
+	//
 	//print_run_queue();
-	
-	return q_remhead(runqueue);
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		if (!q_empty(runqueues[i])) {
+			numrunnable--;
+			return q_remhead(runqueues[i]);
+		}
+	}
+
+	if (array_getnum(stridequeue) > 0) {
+		numrunnable--;
+		return stride_remmin();
+	}
+
+	panic("scheduler: numrunnable is %d but all queues are empty\n",
+	      numrunnable);
+	return NULL;
 }
 
-/* 
+/*
  * Make a thread runnable.
- * With the base scheduler, just add it to the end of the run queue.
+ * Add it to the end of the run queue for its priority level, or to
+ * the stride queue.
  */
 int
 make_runnable(struct thread *t)
 {
+	int result;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	return q_addtail(runqueue, t);
+	if (t->t_epoch != aging_epoch) {
+		/* Missed an aging pass while asleep or running. */
+		t->t_epoch = aging_epoch;
+		t->t_priority = t->t_basepriority;
+		t->t_ticks = 0;
+	}
+
+	/* Start timing the wait. */
+	rusage_stamp(t);
+
+	assert(t->t_priority >= 0 && t->t_priority < SCHED_NLEVELS);
+	result = sched_enqueue(t, scheduler_level(t));
+	if (result == 0) {
+		numrunnable++;
+	}
+	return result;
+}
+
+/*
+ * Move every runnable thread back up to its base level.
+ *
+ * Bumping aging_epoch (done in scheduler_tick) is what actually ages
+ * everything; this just gets the threads already sitting on the lower
+ * run queues moved up without waiting for them to run. That's a walk
+ * over every runnable thread, so it runs from the system workqueue
+ * rather than in the timer interrupt, one thread at a time with
+ * interrupts back on in between. Threads that come through
+ * make_runnable meanwhile already have the new epoch and are left
+ * where they are.
+ */
+static
+void
+scheduler_age(void *unused)
+{
+	struct thread *t;
+	int i, n, spl, result;
+
+	(void)unused;
+
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		spl = splhigh();
+		n = q_length(runqueues[i]);
+		splx(spl);
+
+		while (n-- > 0) {
+			spl = splhigh();
+			if (q_empty(runqueues[i])) {
+				splx(spl);
+				break;
+			}
+			t = q_remhead(runqueues[i]);
+			if (t->t_epoch != aging_epoch) {
+				t->t_epoch = aging_epoch;
+				t->t_priority = t->t_basepriority;
+				t->t_ticks = 0;
+			}
+			/* preallocated for all threads, can't fail */
+			result = q_addtail(runqueues[scheduler_level(t)], t);
+			assert(result==0);
+			splx(spl);
+		}
+	}
+}
+
+/*
+ * Called from hardclock on every tick, with interrupts off.
+ *
+ * Charges the tick to the current thread and starts the aging pass
+ * when it's due. Returns nonzero if the current thread should give
+ * up the processor: either it used up its quantum (in which case it
+ * has been demoted) and something else is ready to run, or something
+ * of higher priority is waiting. A thread that uses up its quantum
+ * with nothing else runnable keeps going; switching to ourselves
+ * would only cost a context switch.
+ */
+int
+scheduler_tick(void)
+{
+	int i, level;
+
+	assert(curspl>0);
+
+	aging_counter++;
+	if (aging_counter >= SCHED_AGING_TICKS) {
+		aging_counter = 0;
+		aging_epoch++;
+		workqueue_schedule(&aging_work);
+	}
+
+	/* Nothing to charge if we're in the idle loop. */
+	if (curthread == NULL) {
+		return 0;
+	}
+
+	level = scheduler_level(curthread);
+	curthread->t_ticks++;
+
+	if (level == SCHED_NLEVELS) {
+		/* Stride class: pay for the tick, fixed quantum. */
+		curthread->t_pass += curthread->t_stride;
+		if (curthread->t_ticks >= QUANTUM(0)) {
+			curthread->t_ticks = 0;
+			return numrunnable > 0;
+		}
+	}
+	else if (curthread->t_ticks >= QUANTUM(level)) {
+		if (curthread->t_priority < SCHED_NLEVELS-1) {
+			curthread->t_priority++;
+		}
+		curthread->t_ticks = 0;
+		return numrunnable > 0;
+	}
+
+	for (i=0; i<level; i++) {
+		if (!q_empty(runqueues[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Called when T wakes up from thread_sleep, before make_runnable.
+ * Sleeping is what interactive and I/O-bound threads do, so move
+ * it up a level and give it a fresh quantum.
+ */
+void
+scheduler_boost(struct thread *t)
+{
+	assert(curspl>0);
+
+	if (t->t_priority > t->t_basepriority) {
+		t->t_priority--;
+	}
+	t->t_ticks = 0;
+}
+
+/*
+ * Set the base priority level of thread T. The thread's current
+ * level is reset to it as well. Takes effect the next time T goes on
+ * a run queue. Returns an error code.
+ */
+int
+scheduler_setpriority(struct thread *t, int level)
+{
+	int spl;
+
+	if (level < 0 || level >= SCHED_NLEVELS) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	t->t_basepriority = level;
+	t->t_priority = level;
+	t->t_ticks = 0;
+	t->t_epoch = aging_epoch;
+	splx(spl);
+
+	return 0;
+}
+
+/*
+ * Set the level T inherits from lock waiters (SCHED_NLEVELS for
+ * none). If T is on a run queue, it moves to the right one.
+ */
+void
+scheduler_setinherit(struct thread *t, int level)
+{
+	int oldlevel, newlevel, result;
+
+	assert(curspl>0);
+	assert(level >= 0 && level <= SCHED_NLEVELS);
+
+	oldlevel = scheduler_level(t);
+	t->t_inherit = level;
+	newlevel = scheduler_level(t);
+
+	if (oldlevel != newlevel && sched_dequeue(t, oldlevel)) {
+		/* preallocated for all threads, can't fail */
+		result = sched_enqueue(t, newlevel);
+		assert(result==0);
+	}
+}
+
+/*
+ * Put T in the stride class with TICKETS tickets, or back in the MLFQ
+ * if TICKETS is 0. Returns an error code.
+ */
+int
+scheduler_setshare(struct thread *t, int tickets)
+{
+	int spl, oldlevel, newlevel, result;
+
+	if (tickets < 0 || tickets > STRIDE_MAXTICKETS) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+
+	oldlevel = scheduler_level(t);
+	t->t_tickets = tickets;
+	t->t_stride = tickets > 0 ? STRIDE1 / tickets : 0;
+	t->t_pass = stride_pass;
+	t->t_ticks = 0;
+	newlevel = scheduler_level(t);
+
+	if (oldlevel != newlevel && sched_dequeue(t, oldlevel)) {
+		/* preallocated for all threads, can't fail */
+		result = sched_enqueue(t, newlevel);
+		assert(result==0);
+	}
+
+	splx(spl);
+	return 0;
+}
+
+/*
+ * Return nonzero if something is runnable at a higher level than the
+ * current thread.
+ */
+int
+scheduler_preempted(void)
+{
+	int i, level;
+
+	assert(curspl>0);
+
+	level = scheduler_level(curthread);
+	for (i=0; i<level; i++) {
+		if (!q_empty(runqueues[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Set the time slice, in hardclock ticks, for the top level. Lower
+ * levels get proportionally longer ones. Returns an error code.
+ */
+int
+scheduler_setquantum(int ticks)
+{
+	int spl;
+
+	/* Keep the bottom level's quantum from overflowing. */
+	if (ticks < 1 || ticks > HZ) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	sched_quantum = ticks;
+	splx(spl);
+
+	return 0;
+}
+
+/*
+ * Print the length and quantum of each run queue.
+ */
+void
+scheduler_printstats(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+
+	kprintf("Run queues (%d runnable):\n", numrunnable);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		kprintf("  level %d: quantum %2d ticks, %3d threads\n",
+			i, QUANTUM(i), q_length(runqueues[i]));
+	}
+	kprintf("  stride:  quantum %2d ticks, %3d threads\n",
+		QUANTUM(0), array_getnum(stridequeue));
+
+	splx(spl);
 }
 
 /*
@@ -126,15 +661,27 @@ print_run_queue(void)
 	/* Turn interrupts off so the whole list prints atomically. */
 	int spl = splhigh();
 
-	int i,k=0;
-	i = q_getstart(runqueue);
-	
-	while (i!=q_getend(runqueue)) {
-		struct thread *t = q_getguy(runqueue, i);
-		kprintf("  %2d: %s %p\n", k, t->t_name, t->t_sleepaddr);
-		i=(i+1)%q_getsize(runqueue);
+	int i,k=0,level;
+
+	for (level=0; level<SCHED_NLEVELS; level++) {
+		struct queue *q = runqueues[level];
+
+		i = q_getstart(q);
+		while (i!=q_getend(q)) {
+			struct thread *t = q_getguy(q, i);
+			kprintf("  %2d: [%d] %s %p\n", k, level, t->t_name,
+				t->t_sleepaddr);
+			i=(i+1)%q_getsize(q);
+			k++;
+		}
+	}
+
+	for (i=0; i<array_getnum(stridequeue); i++) {
+		struct thread *t = array_getguy(stridequeue, i);
+		kprintf("  %2d: [S] %s %p pass %u\n", k, t->t_name,
+			t->t_sleepaddr, t->t_pass);
 		k++;
 	}
-	
+
 	splx(spl);
 }
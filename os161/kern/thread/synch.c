@@ -4,11 +4,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
 #include <thread.h>
 #include <curthread.h>
 #include <machine/spl.h>
+#include <scheduler.h>
+#include <timeout.h>
+#include <kmem_cache.h>
 
 /* Forward declaration for a field in lock structure */
 extern struct thread *curthread;
@@ -17,6 +21,12 @@ extern struct thread *curthread;
 //
 // Semaphore.
 
+/* Nonzero to wake only as many sleepers as there are new permits. */
+int sem_wakeone = 1;
+
+static struct kmem_cache sem_cache =
+	KMEM_CACHE_INIT("semaphore", sizeof(struct semaphore), NULL, NULL);
+
 struct semaphore *
 sem_create(const char *namearg, int initial_count)
 {
@@ -24,18 +34,19 @@ sem_create(const char *namearg, int initial_count)
 
 	assert(initial_count >= 0);
 
-	sem = kmalloc(sizeof(struct semaphore));
+	sem = kmem_cache_alloc(&sem_cache);
 	if (sem == NULL) {
 		return NULL;
 	}
 
 	sem->name = kstrdup(namearg);
 	if (sem->name == NULL) {
-		kfree(sem);
+		kmem_cache_free(&sem_cache, sem);
 		return NULL;
 	}
 
 	sem->count = initial_count;
+	sem->waiters = 0;
 	return sem;
 }
 
@@ -46,7 +57,7 @@ sem_destroy(struct semaphore *sem)
 	assert(sem != NULL);
 
 	spl = splhigh();
-	assert(thread_hassleepers(sem)==0);
+	assert(sem->waiters==0);
 	splx(spl);
 
 	/*
@@ -59,7 +70,7 @@ sem_destroy(struct semaphore *sem)
 	 */
 
 	kfree(sem->name);
-	kfree(sem);
+	kmem_cache_free(&sem_cache, sem);
 }
 
 void 
@@ -78,6 +89,8 @@ P(struct semaphore *sem)
 
 	spl = splhigh();
 	while (sem->count==0) { //the lowest number of sem->count is 0 !
+		/* V takes us off the count when it wakes us. */
+		sem->waiters++;
 		thread_sleep(sem); //put the current thread to wait queue and do the context switch.
 	}
 	if(sem->count<0) kprintf("after sleep: sem->count == %d and the sem is %s \n" , sem->count,sem->name);
@@ -86,15 +99,87 @@ P(struct semaphore *sem)
 	splx(spl);
 }
 
+/*
+ * P without blocking: take a permit if there is one, else return
+ * EAGAIN.
+ */
+int
+P_try(struct semaphore *sem)
+{
+	int spl, result = 0;
+	assert(sem != NULL);
+
+	spl = splhigh();
+	if (sem->count > 0) {
+		sem->count--;
+	}
+	else {
+		result = EAGAIN;
+	}
+	splx(spl);
+	return result;
+}
+
+/*
+ * P, but give up after TICKS ticks. A sleeper that times out was never
+ * woken by V, so its timer takes it off the waiter count.
+ */
+int
+P_timeout(struct semaphore *sem, int ticks)
+{
+	u_int32_t deadline;
+	int spl, left;
+	assert(sem != NULL);
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+	deadline = timeout_ticks() + ticks;
+	while (sem->count==0) {
+		left = (int)(deadline - timeout_ticks());
+		if (left <= 0) {
+			splx(spl);
+			return ETIMEDOUT;
+		}
+		sem->waiters++;
+		thread_sleep_timeout(sem, left, &sem->waiters);
+	}
+	assert(sem->count>0);
+	sem->count--;
+	splx(spl);
+	return 0;
+}
+
 void
 V(struct semaphore *sem)
+{
+	V_n(sem, 1);
+}
+
+/*
+ * Add N to the count and wake up to N sleepers, one per permit. A
+ * thread that comes along in P before they run can still take a
+ * permit first; the one that loses out just goes back to sleep.
+ */
+void
+V_n(struct semaphore *sem, int n)
 {
 	int spl;
 	assert(sem != NULL);
+	assert(n > 0);
 	spl = splhigh();
-	sem->count++;
+	sem->count += n;
 	assert(sem->count>0);
-	thread_wakeup(sem); //broadcast !
+	if (!sem_wakeone) {
+		sem->waiters = 0;
+		thread_wakeup(sem); //broadcast !
+	}
+	while (n > 0 && sem->waiters > 0) {
+		if (thread_wakeup_single(sem) == NULL) {
+			break;
+		}
+		sem->waiters--;
+		n--;
+	}
 	splx(spl);
 }
 
@@ -102,23 +187,236 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/* Nonzero to do priority inheritance. */
+int lock_inheritance = 1;
+
+/* Nonzero to hand a released lock straight to its next waiter. */
+int lock_handoff = 1;
+
+/* How far down a chain of blocked lock holders to pass priority. */
+#define LOCK_MAXCHAIN 16
+
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INIT("lock", sizeof(struct lock), NULL, NULL);
+
+/*
+ * Make T the holder of LOCK.
+ */
+static
+void
+lock_give(struct lock *lock, struct thread *t)
+{
+	assert(curspl>0);
+	assert(lock->held == 0);
+
+	lock->held = 1;
+	lock->holder = t;
+	lock->lk_nextheld = t->t_heldlocks;
+	t->t_heldlocks = lock;
+	lockstat_acquired(lock);
+}
+
+/*
+ * Make curthread the holder of LOCK.
+ */
+static
+void
+lock_grab(struct lock *lock)
+{
+	lock_give(lock, curthread);
+}
+
+/*
+ * Make LOCK free again.
+ */
+static
+void
+lock_drop(struct lock *lock)
+{
+	struct lock **link;
+	struct thread *holder = (struct thread *)lock->holder;
+
+	assert(curspl>0);
+
+	lockstat_released(lock);
+	if (holder != NULL) {
+		for (link = &holder->t_heldlocks; *link != NULL;
+		     link = &(*link)->lk_nextheld) {
+			if (*link == lock) {
+				*link = lock->lk_nextheld;
+				break;
+			}
+		}
+	}
+	lock->lk_nextheld = NULL;
+	lock->held = 0;
+	lock->holder = NULL;
+}
+
+/*
+ * WAITER is about to sleep (or has just been put to sleep by
+ * cv_signal) waiting for LOCK. Lend its priority to the holder, and if
+ * the holder is itself waiting for a lock, to that lock's holder, and
+ * so on down the chain.
+ */
+static
+void
+lock_donate(struct thread *waiter, struct lock *lock)
+{
+	struct thread *t;
+	int level, depth;
+
+	assert(curspl>0);
+
+	waiter->t_blockedon = lock;
+	if (!lock_inheritance) {
+		return;
+	}
+
+	level = scheduler_level(waiter);
+	for (depth = 0; lock != NULL && depth < LOCK_MAXCHAIN; depth++) {
+		t = (struct thread *)lock->holder;
+		if (t == NULL || scheduler_level(t) <= level) {
+			break;
+		}
+		scheduler_setinherit(t, level);
+		lock = t->t_blockedon;
+	}
+}
+
+/*
+ * Curthread has let go of one or more locks. Work out what priority
+ * it should still be inheriting from waiters on the ones it has left.
+ * Returns nonzero if it was inheriting anything before.
+ */
+static
+int
+lock_undonate(void)
+{
+	struct lock *l;
+	int level, best = SCHED_NLEVELS;
+
+	assert(curspl>0);
+
+	if (curthread->t_inherit == SCHED_NLEVELS) {
+		/* Wasn't inheriting anything; nothing to do. */
+		return 0;
+	}
+
+	for (l = curthread->t_heldlocks; l != NULL; l = l->lk_nextheld) {
+		level = thread_sleepers_level(l);
+		if (level < best) {
+			best = level;
+		}
+	}
+	scheduler_setinherit(curthread, best);
+	return 1;
+}
+
+/*
+ * Let go of LOCK, which curthread holds.
+ *
+ * With lock_handoff set, the thread that has been waiting longest
+ * becomes the new holder right here, and is the only one woken up. It
+ * takes over the priority the remaining waiters were lending to us.
+ * Otherwise every waiter is woken to fight over it, which is how it
+ * used to be done and is kept for comparison (see sy5).
+ */
+static
+void
+lock_pass(struct lock *lock)
+{
+	struct thread *t;
+	int level;
+
+	assert(curspl>0);
+
+	lock_drop(lock);
+
+	if (!lock_handoff) {
+		thread_wakeup(lock);
+		return;
+	}
+
+	t = thread_wakeup_single(lock);
+	if (t == NULL) {
+		return;
+	}
+	lock_give(lock, t);
+	t->t_blockedon = NULL;
+
+	if (lock_inheritance) {
+		level = thread_sleepers_level(lock);
+		if (level < t->t_inherit) {
+			scheduler_setinherit(t, level);
+		}
+	}
+}
+
+/*
+ * Sleep until curthread holds LOCK, which is held by someone else
+ * right now. The lock may be handed to us by lock_pass, or (if
+ * handoff is off) we may have to grab it when it comes free.
+ */
+static
+void
+lock_wait(struct lock *lock)
+{
+	u_int32_t start = lockstat_now();
+	int slept = 0;
+
+	assert(curspl>0);
+
+	while (lock->holder != curthread) {
+		if (lock->held == 0) {
+			lock_grab(lock);
+			break;
+		}
+		lock_donate(curthread, lock);
+		thread_sleep(lock);
+		slept = 1;
+	}
+	curthread->t_blockedon = NULL;
+	if (slept) {
+		lockstat_waited(lock, start);
+	}
+}
+
+/*
+ * Called at the end of a release with the interrupt level the caller
+ * had. If we were running on borrowed priority and the thread we
+ * borrowed it from can now run, let it. Not if the caller has
+ * interrupts off, though: cv_wait releases the lock and goes to
+ * sleep as one atomic step.
+ */
+static
+void
+lock_release_yield(int wasinheriting, int spl)
+{
+	if (wasinheriting && spl == 0 && scheduler_preempted()) {
+		thread_yield();
+	}
+}
+
 struct lock *
 lock_create(const char *name)
 {
 	struct lock *lock;
-	lock = kmalloc(sizeof(struct lock));
+	lock = kmem_cache_alloc(&lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
 	lock->name = kstrdup(name);
 	if (lock->name == NULL) {
-		kfree(lock);
+		kmem_cache_free(&lock_cache, lock);
 		return NULL;
 	}
 	lock-> held = 0;
 	// add stuff here as needed
 	lock-> holder = NULL;
+	lock-> lk_nextheld = NULL;
+	lockstat_register(lock);
 	return lock;
 }
 
@@ -128,9 +426,10 @@ lock_destroy(struct lock *lock)
 	assert(lock != NULL);
 	int spl = splhigh();
 	// add stuff here as needed
+	lockstat_unregister(lock);
 	
 	kfree(lock->name);
-	kfree(lock);
+	kmem_cache_free(&lock_cache, lock);
 	splx(spl);
 }
 
@@ -156,115 +455,216 @@ void lock_acquire_ (struct lock *lock) {
 
 void lock_acquire(struct lock* lock) {
 	int spl = splhigh();
-	while (lock->held != 0) {
-		thread_sleep(lock);
-	} 
-	
-	lock->held = 1;
-	lock->holder = curthread;
-	
+	assert(lock->holder != curthread);
+	if (lock->held != 0) {
+		lock_wait(lock);
+	}
+	else {
+		lock_grab(lock);
+	}
 	splx(spl);
 }
 
-void lock_acquire_two(struct lock* lock1, struct lock* lock2) {
-	int spl = splhigh();
-	while (1) {
-		if(lock1->held == 0) {
-			//get the lock 1:
-			lock1->held = 1;
-			lock1->holder = curthread;
-			//try to get lock 2:
-			if(lock2->held == 1)
-			{
-				//first release lock1 and then spin:
-				lock1->held = 0;
-				lock1->holder = NULL;
-				thread_sleep(lock2);
-			}
-			else //the lock2 is available
-			{
-				lock2->held = 1;
-				lock2->holder = curthread;
-				break;
-			}
+/*
+ * Get LOCK if nobody has it, without waiting. Returns EAGAIN if it's
+ * held.
+ */
+int
+lock_tryacquire(struct lock *lock)
+{
+	int spl, result = 0;
+
+	spl = splhigh();
+	assert(lock->holder != curthread);
+	if (lock->held == 0) {
+		lock_grab(lock);
+	}
+	else {
+		result = EAGAIN;
+	}
+	splx(spl);
+	return result;
+}
+
+/*
+ * lock_acquire, but give up after TICKS ticks. Whatever priority we
+ * lent the holder stays with it until it next releases a lock.
+ */
+int
+lock_acquire_timeout(struct lock *lock, int ticks)
+{
+	u_int32_t deadline, start = lockstat_now();
+	int spl, left, result = 0, slept = 0;
+
+	spl = splhigh();
+	assert(lock->holder != curthread);
+
+	deadline = timeout_ticks() + ticks;
+	while (lock->holder != curthread) {
+		if (lock->held == 0) {
+			lock_grab(lock);
+			break;
 		}
-		else{
-			thread_sleep(lock1);
+		left = (int)(deadline - timeout_ticks());
+		if (left <= 0) {
+			result = ETIMEDOUT;
+			break;
 		}
+		lock_donate(curthread, lock);
+		thread_sleep_timeout(lock, left, NULL);
+		slept = 1;
+	}
+	curthread->t_blockedon = NULL;
+	if (slept) {
+		lockstat_waited(lock, start);
 	}
 	splx(spl);
+	return result;
 }
 
+/*
+ * Lock order for lock_acquire_n: by address.
+ */
+#define LOCK_BEFORE(a, b) ((vaddr_t)(a) < (vaddr_t)(b))
 
-void lock_acquire_three(struct lock* lock1, struct lock* lock2, struct lock* lock3) {
-	int spl = splhigh();
-	while (1) { 
-		if (lock1->held == 0) {
-			// lock1 is available, delay the grab and check lock2
-
-			if (lock2->held == 0) {
-				// lock2 is available, go check lock3
-				if (lock3->held == 0) {
-					// all three locks are available, do the acquire
-					lock1->held = 1;
-					lock2->held = 1;
-					lock3->held = 1;
-					lock1->holder = curthread;
-					lock2->holder = curthread;
-					lock3->holder = curthread;
-					break;
-				} else {
-					thread_sleep(lock3);
-				}
-			} else {
-				// lock2 unavailable 
-				thread_sleep(lock2);
+/*
+ * Get all N locks in LOCKS.
+ *
+ * If every one of them is free, they are all taken right away, in
+ * whatever order they were given: nothing sleeps, so nothing can
+ * deadlock. Otherwise they are taken one at a time in address order,
+ * waiting for each in turn while holding the ones before it. Every
+ * thread that comes through here goes in the same order, so no two of
+ * them can each hold a lock the other is waiting for.
+ *
+ * A lock may appear more than once in LOCKS; it is taken once.
+ */
+void
+lock_acquire_n(struct lock **locks, int n)
+{
+	struct lock *sorted[LOCK_MAXN], *l;
+	int spl, i, j, m;
+
+	assert(n > 0 && n <= LOCK_MAXN);
+
+	spl = splhigh();
+
+	for (i=0; i<n; i++) {
+		assert(locks[i]->holder != curthread);
+		if (locks[i]->held) {
+			break;
+		}
+	}
+	if (i == n) {
+		for (i=0; i<n; i++) {
+			if (locks[i]->holder != curthread) {
+				lock_grab(locks[i]);
 			}
-		} else {
-			thread_sleep(lock1);
+		}
+		splx(spl);
+		return;
+	}
+
+	/* Insertion sort, dropping duplicates. */
+	m = 0;
+	for (i=0; i<n; i++) {
+		l = locks[i];
+		for (j=m; j>0 && LOCK_BEFORE(l, sorted[j-1]); j--) {
+			sorted[j] = sorted[j-1];
+		}
+		if (j > 0 && sorted[j-1] == l) {
+			/* Already there; close the gap again. */
+			for (; j<m; j++) {
+				sorted[j] = sorted[j+1];
+			}
+			continue;
+		}
+		sorted[j] = l;
+		m++;
+	}
+
+	for (i=0; i<m; i++) {
+		if (sorted[i]->held) {
+			lock_wait(sorted[i]);
+		}
+		else {
+			lock_grab(sorted[i]);
 		}
 	}
 
 	splx(spl);
 }
 
-/* Declaration of the single thread wakeup function */
+/*
+ * Release all N locks in LOCKS, which curthread holds.
+ */
+void
+lock_release_n(struct lock **locks, int n)
+{
+	int spl, i;
 
-void lock_release(struct lock* lock) {
-	int spl = splhigh();
-	thread_wakeup(lock);
-	lock->held = 0;
-	lock->holder = NULL;
+	spl = splhigh();
+	for (i=0; i<n; i++) {
+		/* Skip duplicates already released. */
+		if (locks[i]->holder == curthread) {
+			lock_pass(locks[i]);
+		}
+	}
+	lock_release_yield(lock_undonate(), spl);
 	splx(spl);
 }
 
 void
-lock_release_two(struct lock *lock1, struct lock* lock2)
+lock_acquire_two(struct lock *lock1, struct lock *lock2)
 {
-	int spl = splhigh();
-	lock1->held = 0;
-	lock1->holder = NULL;
-	lock2->held = 0;
-	lock2->holder = NULL;
-	thread_wakeup(lock1);
-	thread_wakeup(lock2);
-	splx(spl);
+	struct lock *locks[2];
+
+	locks[0] = lock1;
+	locks[1] = lock2;
+	lock_acquire_n(locks, 2);
 }
+
 void
-lock_release_three (struct lock* lock1, struct lock* lock2, struct lock* lock3) {
+lock_acquire_three(struct lock *lock1, struct lock *lock2,
+		   struct lock *lock3)
+{
+	struct lock *locks[3];
+
+	locks[0] = lock1;
+	locks[1] = lock2;
+	locks[2] = lock3;
+	lock_acquire_n(locks, 3);
+}
+
+void lock_release(struct lock* lock) {
 	int spl = splhigh();
-	lock1->held = 0;
-	lock1->holder = NULL;
-	lock2->held = 0;
-	lock2->holder = NULL;
-	lock3->held = 0;
-	lock3->holder = NULL;
-	thread_wakeup(lock1);
-	thread_wakeup(lock2);
-	thread_wakeup(lock3);
+	lock_pass(lock);
+	lock_release_yield(lock_undonate(), spl);
 	splx(spl);
 }
 
+void
+lock_release_two(struct lock *lock1, struct lock *lock2)
+{
+	struct lock *locks[2];
+
+	locks[0] = lock1;
+	locks[1] = lock2;
+	lock_release_n(locks, 2);
+}
+
+void
+lock_release_three(struct lock *lock1, struct lock *lock2,
+		   struct lock *lock3)
+{
+	struct lock *locks[3];
+
+	locks[0] = lock1;
+	locks[1] = lock2;
+	locks[2] = lock3;
+	lock_release_n(locks, 3);
+}
+
 int
 lock_do_i_hold(struct lock *lock)
 {
@@ -292,7 +692,7 @@ cv_create(const char *name)
 		return NULL;
 	}
 	
-	// add stuff here as needed
+	cv->cv_nwaiters = 0;
 	
 	return cv;
 }
@@ -302,47 +702,98 @@ cv_destroy(struct cv *cv)
 {
 	int spl = splhigh();
 	assert(cv != NULL);
+	assert(cv->cv_nwaiters == 0);
 
-	// add stuff here as needed
 	kfree(cv->name);
 	kfree(cv);
 	splx(spl);
 }
 
-/* This function causes the current thread to sleep, until 
-	it is waken up by a signal 
-	Note --> precondition: */
+/*
+ * Release LOCK and sleep on CV, as one atomic step, then get LOCK
+ * back. If we were signalled while the signaller held the lock, we
+ * were moved to the lock's queue and it has been handed to us by the
+ * time we wake up; otherwise we wait for it here.
+ */
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-	// disable interrupts to ensure atomic 
-	// operations on wait_queue, and thread_sleep 
-	// will not be interrupted
 	int spl = splhigh();
-	// atomically (by disabling interrupts) release the lock to,
-	// at a later time, let other threads to enter
+
+	assert(lock_do_i_hold(lock));
+
+	cv->cv_nwaiters++;
 	lock_release(lock);
-	// we only need the size of the wait_queue to properly sleep.
-	// array_add(cv->wait_queue, 0);
-	// Trick: let the index/address of the wait_queue elements to be the 
-	// sleep address for the current thread
 	thread_sleep(cv);
-	/* Once the above sleep returns, this thread is waken up by a signal, so
-		we need to let it grab the lock*/
+
+	if (lock->holder != curthread) {
+		lock_wait(lock);
+	}
+	splx(spl);
+}
+
+/*
+ * cv_wait, but if nobody signals within TICKS ticks, stop waiting,
+ * get LOCK back and return ETIMEDOUT. A waiter signalled in time may
+ * have been moved to the lock's queue; that counts as signalled, and
+ * it returns 0 once the lock is handed to it, however long that takes.
+ */
+int
+cv_timedwait(struct cv *cv, struct lock *lock, int ticks)
+{
+	int spl = splhigh();
+	int result;
+
+	assert(lock_do_i_hold(lock));
+
+	cv->cv_nwaiters++;
+	lock_release(lock);
+	/* If we time out, the timer takes us off the count. */
+	result = thread_sleep_timeout(cv, ticks, &cv->cv_nwaiters);
+
+	if (lock->holder != curthread) {
+		lock_wait(lock);
+	}
 	splx(spl);
-	/* This lock is for application-level shared resources */
-	lock_acquire(lock); 
+	return result;
+}
+
+/*
+ * Deal with the thread that has waited longest on CV.
+ *
+ * Waking it while LOCK is held would only have it run and go straight
+ * back to sleep on the lock. So if the lock is held (normally by the
+ * signaller), the waiter is moved, still asleep, to the end of the
+ * lock's queue instead, and lends its priority to the holder like any
+ * other lock waiter. It runs when the lock is passed to it.
+ */
+static
+void
+cv_wakeone(struct cv *cv, struct lock *lock)
+{
+	struct thread *t;
+
+	assert(curspl>0);
+	assert(cv->cv_nwaiters > 0);
+
+	cv->cv_nwaiters--;
+	if (lock->held) {
+		t = thread_wchan_move(cv, lock);
+		assert(t != NULL);
+		lock_donate(t, lock);
+	}
+	else {
+		t = thread_wakeup_single(cv);
+		assert(t != NULL);
+	}
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
 	int spl = splhigh();
-	// if there's no threads waiting, this signal is ignored
-	if (thread_hassleepers(cv)) { 
-		// wake up the first thread in queue
-		thread_wakeup_single(cv);
-		// array_remove(cv->wait_queue, 0);
+	if (cv->cv_nwaiters > 0) {
+		cv_wakeone(cv, lock);
 	}
 	splx(spl);
 }
@@ -351,7 +802,338 @@ void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
 	int spl = splhigh();
- 
-	thread_wakeup(cv);
+	while (cv->cv_nwaiters > 0) {
+		cv_wakeone(cv, lock);
+	}
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+//
+// Waiting readers sleep on the rwlock itself, waiting writers on
+// its rw_writer field.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readers = 0;
+	rw->rw_writer = NULL;
+	rw->rw_waitreaders = 0;
+	rw->rw_waitwriters = 0;
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	int spl = splhigh();
+	assert(rw != NULL);
+	assert(rw->rw_readers == 0);
+	assert(rw->rw_writer == NULL);
+	assert(rw->rw_waitreaders == 0);
+	assert(rw->rw_waitwriters == 0);
+	splx(spl);
+
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+/*
+ * Hand RW to the writer that has waited longest.
+ */
+static
+void
+rwlock_passwriter(struct rwlock *rw)
+{
+	struct thread *t;
+
+	assert(curspl>0);
+	assert(rw->rw_readers == 0 && rw->rw_writer == NULL);
+	assert(rw->rw_waitwriters > 0);
+
+	rw->rw_waitwriters--;
+	t = thread_wakeup_single(&rw->rw_writer);
+	assert(t != NULL);
+	rw->rw_writer = t;
+}
+
+/*
+ * Let every waiting reader in at once. They are counted as holding
+ * RW before they even run, so a writer that comes along meanwhile
+ * waits for the whole batch.
+ */
+static
+void
+rwlock_passreaders(struct rwlock *rw)
+{
+	assert(curspl>0);
+	assert(rw->rw_writer == NULL);
+	assert(rw->rw_waitreaders > 0);
+
+	rw->rw_readers += rw->rw_waitreaders;
+	rw->rw_waitreaders = 0;
+	thread_wakeup(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+	assert(rw->rw_writer != curthread);
+
+	if (rw->rw_writer == NULL && rw->rw_waitwriters == 0) {
+		rw->rw_readers++;
+	}
+	else {
+		/* rwlock_passreaders counts us in when it wakes us. */
+		rw->rw_waitreaders++;
+		thread_sleep(rw);
+		assert(rw->rw_readers > 0);
+	}
+	splx(spl);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+
+	spl = splhigh();
+	assert(rw->rw_readers > 0);
+	assert(rw->rw_writer == NULL);
+
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_waitwriters > 0) {
+		rwlock_passwriter(rw);
+	}
+	splx(spl);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+	assert(rw->rw_writer != curthread);
+
+	if (rw->rw_writer == NULL && rw->rw_readers == 0) {
+		rw->rw_writer = curthread;
+	}
+	else {
+		/* rwlock_passwriter makes us the writer when it wakes us. */
+		rw->rw_waitwriters++;
+		thread_sleep(&rw->rw_writer);
+		assert(rw->rw_writer == curthread);
+	}
+	splx(spl);
+}
+
+/*
+ * Readers that queued up behind us go next, all together; then the
+ * next writer gets its turn once they're done. Taking turns like this
+ * means neither side can starve the other.
+ */
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+
+	spl = splhigh();
+	assert(rw->rw_writer == curthread);
+
+	rw->rw_writer = NULL;
+	if (rw->rw_waitreaders > 0) {
+		rwlock_passreaders(rw);
+	}
+	else if (rw->rw_waitwriters > 0) {
+		rwlock_passwriter(rw);
+	}
+	splx(spl);
+}
+
+int
+rwlock_do_i_write(struct rwlock *rw)
+{
+	return (rw->rw_writer == curthread);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Barrier.
+
+struct barrier *
+barrier_create(const char *name, int nthreads)
+{
+	struct barrier *b;
+
+	assert(nthreads > 0);
+
+	b = kmalloc(sizeof(struct barrier));
+	if (b == NULL) {
+		return NULL;
+	}
+
+	b->b_name = kstrdup(name);
+	if (b->b_name == NULL) {
+		kfree(b);
+		return NULL;
+	}
+
+	b->b_nthreads = nthreads;
+	b->b_arrived = 0;
+	b->b_round = 0;
+	return b;
+}
+
+void
+barrier_destroy(struct barrier *b)
+{
+	int spl = splhigh();
+	assert(b != NULL);
+	assert(b->b_arrived == 0);
+	splx(spl);
+
+	kfree(b->b_name);
+	kfree(b);
+}
+
+/*
+ * The round number tells a woken thread that its round is over, even
+ * if a fast thread has already started arriving for the next one.
+ */
+int
+barrier_wait(struct barrier *b)
+{
+	unsigned round;
+	int spl;
+
+	assert(b != NULL);
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+
+	b->b_arrived++;
+	if (b->b_arrived == b->b_nthreads) {
+		b->b_arrived = 0;
+		b->b_round++;
+		thread_wakeup(b);
+		splx(spl);
+		return 1;
+	}
+
+	round = b->b_round;
+	while (b->b_round == round) {
+		thread_sleep(b);
+	}
+	splx(spl);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Wait group.
+
+struct waitgroup *
+waitgroup_create(const char *name)
+{
+	struct waitgroup *wg;
+
+	wg = kmalloc(sizeof(struct waitgroup));
+	if (wg == NULL) {
+		return NULL;
+	}
+
+	wg->wg_name = kstrdup(name);
+	if (wg->wg_name == NULL) {
+		kfree(wg);
+		return NULL;
+	}
+
+	wg->wg_count = 0;
+	return wg;
+}
+
+void
+waitgroup_destroy(struct waitgroup *wg)
+{
+	int spl = splhigh();
+	assert(wg != NULL);
+	assert(wg->wg_count == 0);
+	assert(!thread_hassleepers(wg));
+	splx(spl);
+
+	kfree(wg->wg_name);
+	kfree(wg);
+}
+
+void
+waitgroup_add(struct waitgroup *wg, int n)
+{
+	int spl;
+
+	assert(wg != NULL);
+	assert(n >= 0);
+
+	spl = splhigh();
+	wg->wg_count += n;
+	splx(spl);
+}
+
+void
+waitgroup_done(struct waitgroup *wg)
+{
+	int spl;
+
+	assert(wg != NULL);
+
+	spl = splhigh();
+	assert(wg->wg_count > 0);
+	wg->wg_count--;
+	if (wg->wg_count == 0) {
+		thread_wakeup(wg);
+	}
+	splx(spl);
+}
+
+void
+waitgroup_wait(struct waitgroup *wg)
+{
+	int spl;
+
+	assert(wg != NULL);
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+	while (wg->wg_count > 0) {
+		thread_sleep(wg);
+	}
 	splx(spl);
 }
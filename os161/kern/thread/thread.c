@@ -12,6 +12,10 @@
 #include <scheduler.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <rusage.h>
+#include <schedlat.h>
+#include <timeout.h>
+#include <kmem_cache.h>
 #include "opt-synchprobs.h"
 
 /* States a thread can be in. */
@@ -25,14 +29,105 @@ typedef enum {
 /* Global variable for the thread currently executing at any given time. */
 struct thread *curthread;
 
-/* Table of sleeping threads. */
-static struct array *sleepers;
+/*
+ * Wait channels.
+ *
+ * Sleeping threads are kept in a hash table keyed by sleep address.
+ * Each bucket is a chain of channels (one per distinct address that
+ * hashes there); each channel is a FIFO list of the threads sleeping
+ * on that address. The first thread on a channel doubles as the
+ * channel record: its t_wchan_next links to the next channel in the
+ * bucket and its t_wq_tail points at the last sleeper, so no memory
+ * is needed beyond the thread structures themselves.
+ *
+ * So waking a channel costs the length of the bucket chain (usually
+ * one or two channels) plus the number of threads woken.
+ */
+#define NWCHANS 64		/* must be a power of 2 */
+static struct thread *wchans[NWCHANS];
+
+/* Total number of sleeping threads. */
+static int numsleepers;
 
 /* List of dead threads to be disposed of. */
 static struct array *zombies;
 
 /* Total number of outstanding threads. Does not count zombies[]. */
 static int numthreads;
+
+/*
+ * Thread cache.
+ *
+ * Dead threads that had a stack are kept here, stack and all, instead
+ * of being freed, so thread_fork can reuse them without going to
+ * kmalloc. The stack magic is left in place, and the name buffer is
+ * reused if the new name fits. The cache is linked through t_wq_next
+ * (cached threads are never asleep) and is emptied by
+ * thread_cache_reclaim when memory gets tight.
+ */
+#define THREAD_CACHE_MAX 16
+static struct thread *thread_cache;
+static int thread_cache_count;
+
+/* Statistics, for thread_cache_printstats. */
+static unsigned thread_cache_hits;
+static unsigned thread_cache_misses;
+static unsigned thread_cache_reclaimed;
+
+/*
+ * Kernel stack sizing.
+ *
+ * Everything above the stack magic is filled with STACK_FILL when a
+ * thread is forked. The stack grows down from the top, so the lowest
+ * byte that no longer holds the pattern marks the deepest the thread
+ * ever got. That's recorded per thread name in stackstats[] when the
+ * thread exits, so you can see how much stack each kind of thread
+ * really needs before making user-process stacks (thread_userstack)
+ * smaller.
+ */
+#define STACK_MAGICSIZE 4
+#define STACK_FILL 0xa5
+static size_t thread_userstack = STACK_SIZE;
+
+#define STACKSTAT_MAX 16
+#define STACKSTAT_NAMELEN 20
+static struct stackstat {
+	char ss_name[STACKSTAT_NAMELEN];
+	size_t ss_size;		/* stack size */
+	size_t ss_maxused;	/* deepest use seen */
+	unsigned ss_nexited;	/* threads measured at exit */
+} stackstats[STACKSTAT_MAX];
+static int nstackstats;
+
+/*
+ * PCBs come from an object cache. Each one's mutex is made when the
+ * PCB is first constructed and stays with it from then on, so a freed
+ * PCB must have its mutex back at 1.
+ */
+static
+int
+pcb_ctor(void *obj)
+{
+	pcb_t *pcb = obj;
+
+	pcb->mutex = sem_create("pcb_mutex", 1);
+	if (pcb->mutex == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+pcb_dtor(void *obj)
+{
+	pcb_t *pcb = obj;
+
+	sem_destroy(pcb->mutex);
+}
+
+struct kmem_cache pcb_cache =
+	KMEM_CACHE_INIT("pcb", sizeof(pcb_t), pcb_ctor, pcb_dtor);
 /* kernel PCB container */
 // struct array * PCBs;
 
@@ -40,15 +135,169 @@ static int numthreads;
 
 // extern pcb_t * PCBs[MAX_PID];
 
+static
+unsigned
+wchan_hash(const void *addr)
+{
+	u_int32_t k = (u_int32_t)addr;
+
+	/* Sleep addresses are mostly word-aligned, so mix the high bits in. */
+	k ^= k >> 16;
+	k *= 0x45d9f3b;
+	k ^= k >> 16;
+	return k & (NWCHANS-1);
+}
+
+/*
+ * Find the channel for ADDR. Returns a pointer to the link in the
+ * bucket chain that points to the channel's first thread. If nobody
+ * is sleeping on ADDR, the link points to NULL.
+ */
+static
+struct thread **
+wchan_lookup(const void *addr)
+{
+	struct thread **link;
+
+	for (link = &wchans[wchan_hash(addr)]; *link != NULL;
+	     link = &(*link)->t_wchan_next) {
+		if ((*link)->t_sleepaddr == addr) {
+			break;
+		}
+	}
+	return link;
+}
+
+/*
+ * Put T on the end of the channel for T->t_sleepaddr.
+ */
+static
+void
+wchan_enqueue(struct thread *t)
+{
+	struct thread **link = wchan_lookup(t->t_sleepaddr);
+	struct thread *head = *link;
+
+	t->t_wq_next = NULL;
+	if (head == NULL) {
+		/* New channel; T is its head. */
+		t->t_wchan_next = NULL;
+		t->t_wq_tail = t;
+		*link = t;
+	}
+	else {
+		head->t_wq_tail->t_wq_next = t;
+		head->t_wq_tail = t;
+	}
+	numsleepers++;
+}
+
+/*
+ * Take the first thread off the channel that LINK points to.
+ */
+static
+struct thread *
+wchan_remhead(struct thread **link)
+{
+	struct thread *head = *link;
+	struct thread *next = head->t_wq_next;
+
+	if (next != NULL) {
+		/* NEXT takes over as the channel record. */
+		next->t_wchan_next = head->t_wchan_next;
+		next->t_wq_tail = head->t_wq_tail;
+		*link = next;
+	}
+	else {
+		*link = head->t_wchan_next;
+	}
+
+	head->t_wchan_next = NULL;
+	head->t_wq_next = NULL;
+	head->t_wq_tail = NULL;
+	numsleepers--;
+	return head;
+}
+
+/*
+ * Take T off the channel it's sleeping on, wherever it is in the
+ * queue. Returns 0 if it wasn't there (it has been woken, or moved to
+ * another channel, and just hasn't run yet).
+ */
+static
+int
+wchan_remove(struct thread *t)
+{
+	struct thread **link = wchan_lookup(t->t_sleepaddr);
+	struct thread *head = *link, *p;
+
+	if (head == NULL) {
+		return 0;
+	}
+	if (head == t) {
+		wchan_remhead(link);
+		return 1;
+	}
+	for (p = head; p->t_wq_next != NULL; p = p->t_wq_next) {
+		if (p->t_wq_next == t) {
+			p->t_wq_next = t->t_wq_next;
+			if (head->t_wq_tail == t) {
+				head->t_wq_tail = p;
+			}
+			t->t_wq_next = NULL;
+			numsleepers--;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Set up the fields of a thread structure. T_NAME and T_STACK are
+ * left alone; the caller deals with those.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
+	thread->t_sleepaddr = NULL;
+	thread->t_wchan_next = NULL;
+	thread->t_wq_next = NULL;
+	thread->t_wq_tail = NULL;
+	thread->t_vmspace = NULL;
+
+	thread->t_cwd = NULL;
+
+	thread->pID = 0;
+
+	thread->t_priority = 0;
+	thread->t_basepriority = 0;
+	thread->t_ticks = 0;
+	thread->t_epoch = 0;
+	thread->t_inherit = SCHED_NLEVELS;
+	thread->t_tickets = 0;
+	thread->t_stride = 0;
+	thread->t_pass = 0;
+	thread->t_heldlocks = NULL;
+	thread->t_blockedon = NULL;
+
+	bzero(&thread->t_rusage, sizeof(thread->t_rusage));
+	thread->t_stampsecs = 0;
+	thread->t_stampnsecs = 0;
+	bzero(thread->t_lathist, sizeof(thread->t_lathist));
+	thread->t_woken = 0;
+	
+
+	// If you add things to the thread structure, be sure to initialize
+	// them here.
+}
+
 /*
  * Create a thread. This is used both to create the first thread's 
  * thread structure and to create subsequent threads.
  * Note: this does not actually run the thread, instead it intiailizes 
  * a thread structure in kernel. What a bad name for the function!
  */
-
-
-
 static
 struct thread *
 thread_create(const char *name)
@@ -62,22 +311,288 @@ thread_create(const char *name)
 		kfree(thread);
 		return NULL;
 	}
-	thread->t_sleepaddr = NULL;
 	thread->t_stack = NULL;
-	thread->t_vmspace = NULL;
-
-	thread->t_cwd = NULL;
-
-	thread->pID = 0;
-	
+	thread->t_stacksize = 0;
+	thread_init(thread);
 	
+	return thread;
+}
 
-	// If you add things to the thread structure, be sure to initialize
-	// them here.
+/*
+ * Free a thread structure and everything hanging off it.
+ */
+static
+void
+thread_free(struct thread *thread)
+{
+	if (thread->t_stack) {
+		kfree(thread->t_stack);
+	}
 	
+	kfree(thread->t_name);
+	kfree(thread); //here frees pcb!
+}
+
+/*
+ * Fill the stack of THREAD, apart from the magic, with STACK_FILL.
+ */
+static
+void
+thread_stackfill(struct thread *thread)
+{
+	size_t i;
+
+	for (i = STACK_MAGICSIZE; i < thread->t_stacksize; i++) {
+		thread->t_stack[i] = STACK_FILL;
+	}
+}
+
+/*
+ * Return the number of bytes of THREAD's stack that have been used.
+ */
+static
+size_t
+thread_stackused(struct thread *thread)
+{
+	size_t i;
+
+	for (i = STACK_MAGICSIZE; i < thread->t_stacksize; i++) {
+		if (thread->t_stack[i] != (char)STACK_FILL) {
+			break;
+		}
+	}
+	return thread->t_stacksize - i;
+}
+
+/*
+ * Fold THREAD's stack use into stackstats[]. EXITED says whether it's
+ * the final measurement. Interrupts must be off.
+ */
+static
+void
+thread_stackrecord(struct thread *thread, int exited)
+{
+	struct stackstat *ss;
+	char name[STACKSTAT_NAMELEN];
+	size_t used;
+	int i;
+
+	assert(curspl>0);
+
+	snprintf(name, sizeof(name), "%s", thread->t_name);
+	for (i=0; i<nstackstats; i++) {
+		ss = &stackstats[i];
+		if (ss->ss_size == thread->t_stacksize &&
+		    !strcmp(ss->ss_name, name)) {
+			break;
+		}
+	}
+	if (i == nstackstats) {
+		if (nstackstats == STACKSTAT_MAX) {
+			/* Full; the last slot collects the rest. */
+			i = STACKSTAT_MAX-1;
+			if (stackstats[i].ss_size != 0) {
+				strcpy(stackstats[i].ss_name, "(others)");
+				stackstats[i].ss_size = 0;
+			}
+		}
+		else {
+			nstackstats++;
+			ss = &stackstats[i];
+			strcpy(ss->ss_name, name);
+			ss->ss_size = thread->t_stacksize;
+			ss->ss_maxused = 0;
+			ss->ss_nexited = 0;
+		}
+	}
+	ss = &stackstats[i];
+
+	used = thread_stackused(thread);
+	if (used > ss->ss_maxused) {
+		ss->ss_maxused = used;
+	}
+	if (exited) {
+		ss->ss_nexited++;
+	}
+}
+
+/*
+ * Get a thread with a STACKSIZE-byte stack, from the thread cache if
+ * possible.
+ */
+static
+struct thread *
+thread_create_with_stack(const char *name, size_t stacksize)
+{
+	struct thread *thread, **link;
+	char *newname;
+	int spl;
+
+	spl = splhigh();
+	for (link = &thread_cache; *link != NULL; link = &(*link)->t_wq_next) {
+		if ((*link)->t_stacksize == stacksize) {
+			break;
+		}
+	}
+	thread = *link;
+	if (thread != NULL) {
+		*link = thread->t_wq_next;
+		thread_cache_count--;
+		thread_cache_hits++;
+	}
+	else {
+		thread_cache_misses++;
+	}
+	splx(spl);
+
+	if (thread != NULL) {
+		/* Reuse the old name buffer if it's big enough. */
+		if (strlen(name) <= strlen(thread->t_name)) {
+			strcpy(thread->t_name, name);
+		}
+		else {
+			newname = kstrdup(name);
+			if (newname == NULL) {
+				thread_free(thread);
+				return NULL;
+			}
+			kfree(thread->t_name);
+			thread->t_name = newname;
+		}
+		thread_init(thread);
+		thread_stackfill(thread);
+		return thread;
+	}
+
+	thread = thread_create(name);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	/* Allocate a stack */
+	thread->t_stack = kmalloc(stacksize);
+	if (thread->t_stack==NULL) {
+		thread_free(thread);
+		return NULL;
+	}
+	thread->t_stacksize = stacksize;
+
+	/* stick a magic number on the bottom end of the stack */
+	thread->t_stack[0] = 0xae;
+	thread->t_stack[1] = 0x11;
+	thread->t_stack[2] = 0xda;
+	thread->t_stack[3] = 0x33;
+
+	thread_stackfill(thread);
+
 	return thread;
 }
 
+/*
+ * Free all the threads in the thread cache. Called when memory is
+ * short. Returns the number of threads freed.
+ */
+int
+thread_cache_reclaim(void)
+{
+	struct thread *list, *t;
+	int spl, n = 0;
+
+	spl = splhigh();
+	list = thread_cache;
+	thread_cache = NULL;
+	thread_cache_count = 0;
+
+	while (list != NULL) {
+		t = list;
+		list = t->t_wq_next;
+		thread_free(t);
+		n++;
+	}
+	thread_cache_reclaimed += n;
+	splx(spl);
+
+	return n;
+}
+
+/*
+ * Print thread cache statistics.
+ */
+void
+thread_cache_printstats(void)
+{
+	unsigned total;
+	int spl;
+
+	spl = splhigh();
+	total = thread_cache_hits + thread_cache_misses;
+	kprintf("Thread cache: %d/%d cached, %u hits, %u misses",
+		thread_cache_count, THREAD_CACHE_MAX,
+		thread_cache_hits, thread_cache_misses);
+	if (total > 0) {
+		kprintf(" (%u%% hit rate)", thread_cache_hits * 100 / total);
+	}
+	kprintf(", %u reclaimed\n", thread_cache_reclaimed);
+	splx(spl);
+}
+
+int
+thread_setuserstack(size_t size)
+{
+	if (size < STACK_MINSIZE || size > STACK_SIZE || (size & (size-1))) {
+		return EINVAL;
+	}
+
+	/* Only affects processes started from now on. */
+	thread_userstack = size;
+	return 0;
+}
+
+size_t
+thread_getuserstack(void)
+{
+	return thread_userstack;
+}
+
+/*
+ * Print the deepest stack use seen for each thread name. Running
+ * threads are measured now; the rest were measured when they exited.
+ */
+void
+thread_stack_printstats(void)
+{
+	struct stackstat *ss;
+	int i, pid, spl;
+
+	spl = splhigh();
+
+	for (pid = MIN_PID; pid < MAX_PID; pid++) {
+		if (PCBs[pid] != NULL && !PCBs[pid]->exited &&
+		    PCBs[pid]->this_thread != NULL &&
+		    PCBs[pid]->this_thread->t_stack != NULL) {
+			thread_stackrecord(PCBs[pid]->this_thread, 0);
+		}
+	}
+
+	kprintf("Kernel stacks: %u bytes, %u for user processes\n",
+		STACK_SIZE, thread_userstack);
+	kprintf("%-20s %5s %7s %4s %6s\n",
+		"name", "size", "maxused", "pct", "exited");
+	for (i=0; i<nstackstats; i++) {
+		ss = &stackstats[i];
+		if (ss->ss_size == 0) {
+			kprintf("%-20s %5s %7u %4s %6u\n", ss->ss_name, "-",
+				ss->ss_maxused, "-", ss->ss_nexited);
+			continue;
+		}
+		kprintf("%-20s %5u %7u %3u%% %6u\n", ss->ss_name,
+			ss->ss_size, ss->ss_maxused,
+			ss->ss_maxused * 100 / ss->ss_size, ss->ss_nexited);
+	}
+
+	splx(spl);
+}
+
 /*
  * Destroy a thread.
  *
@@ -89,6 +604,8 @@ static
 void
 thread_destroy(struct thread *thread) //doesn't delete the pcb of this thread !
 {
+	int spl;
+
 	assert(thread != curthread);
 
 	// If you add things to the thread structure, be sure to dispose of
@@ -97,13 +614,27 @@ thread_destroy(struct thread *thread) //doesn't delete the pcb of this thread !
 	// These things are cleaned up in thread_exit.
 	assert(thread->t_vmspace==NULL);
 	assert(thread->t_cwd==NULL);
-	
-	if (thread->t_stack) {
-		kfree(thread->t_stack);
+
+	/* Keep it for the next thread_fork if there's room. */
+	if (thread->t_stack != NULL) {
+		/* The stack magic has to survive to be reused. */
+		assert(thread->t_stack[0] == (char)0xae);
+		assert(thread->t_stack[1] == (char)0x11);
+		assert(thread->t_stack[2] == (char)0xda);
+		assert(thread->t_stack[3] == (char)0x33);
+
+		spl = splhigh();
+		if (thread_cache_count < THREAD_CACHE_MAX) {
+			thread->t_wq_next = thread_cache;
+			thread_cache = thread;
+			thread_cache_count++;
+			splx(spl);
+			return;
+		}
+		splx(spl);
 	}
-	
-	kfree(thread->t_name);
-	kfree(thread); //here frees pcb!
+
+	thread_free(thread);
 }
 
 
@@ -137,7 +668,8 @@ static
 void
 thread_killall(void)
 {
-	int i, result;
+	int i;
+	struct thread *chan, *t;
 
 	assert(curspl>0);
 
@@ -146,23 +678,24 @@ thread_killall(void)
 	 * wake up while we're shutting down.
 	 */
 
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		kprintf("sleep: Dropping thread %s\n", t->t_name);
-
-		/*
-		 * Don't do this: because these threads haven't
-		 * been through thread_exit, thread_destroy will
-		 * get upset. Just drop the threads on the floor,
-		 * which is safer anyway during panic.
-		 *
-		 * array_add(zombies, t);
-		 */
+	for (i=0; i<NWCHANS; i++) {
+		for (chan = wchans[i]; chan != NULL; chan = chan->t_wchan_next) {
+			for (t = chan; t != NULL; t = t->t_wq_next) {
+				kprintf("sleep: Dropping thread %s\n", t->t_name);
+
+				/*
+				 * Don't do this: because these threads haven't
+				 * been through thread_exit, thread_destroy will
+				 * get upset. Just drop the threads on the floor,
+				 * which is safer anyway during panic.
+				 *
+				 * array_add(zombies, t);
+				 */
+			}
+		}
+		wchans[i] = NULL;
 	}
-
-	result = array_setsize(sleepers, 0);
-	/* shrinking array: not supposed to fail */
-	assert(result==0);
+	numsleepers = 0;
 }
 
 /*
@@ -185,20 +718,20 @@ struct thread *
 thread_bootstrap(void)
 {
 	struct thread *me;
+	int i;
 
 	/* Create the data structures we need. */
-	sleepers = array_create();
-	if (sleepers==NULL) {
-		panic("Cannot create sleepers array\n");
+	for (i=0; i<NWCHANS; i++) {
+		wchans[i] = NULL;
 	}
+	numsleepers = 0;
 
 	zombies = array_create();
 	if (zombies==NULL) {
 		panic("Cannot create zombies array\n");
 	}
 	/* Initialize the kernel PCB structure */	
-	int i = 0;
-	for (; i < MAX_PID; i++) {
+	for (i = 0; i < MAX_PID; i++) {
 		PCBs[i] = NULL;
 	}
 
@@ -223,7 +756,7 @@ thread_bootstrap(void)
 	curthread = me;
 
 	/* add this thread's PCB to kernel PCB structure */
-	PCBs[1] = kmalloc(sizeof(pcb_t));
+	PCBs[1] = kmem_cache_alloc(&pcb_cache);
 	if(PCBs[1] == NULL){
 		panic("PCBs[1] can not be allocated.");
 	}
@@ -231,12 +764,7 @@ thread_bootstrap(void)
 	PCBs[1] -> exit_code = -1;
 	PCBs[1] -> this_thread = curthread;
 	PCBs[1] -> parent = -1;
-
-	//#ifdef SEM_IMPL
-	PCBs[1] -> mutex = sem_create("mux", 1);
-	//#elif CV_IMPL 
-	//PCBs[1] -> cv = cv_create("sds");
-	//#endif
+	bzero(&PCBs[1]->p_rusage, sizeof(PCBs[1]->p_rusage));
 	
 	curthread->pID = 1;
 
@@ -252,8 +780,7 @@ thread_bootstrap(void)
 void
 thread_shutdown(void)
 {
-	array_destroy(sleepers);
-	sleepers = NULL;
+	assert(numsleepers==0);
 	array_destroy(zombies);
 	zombies = NULL;
 	// Don't do this - it frees our stack and we blow up
@@ -267,36 +794,29 @@ thread_shutdown(void)
  */
 
 
+static
 int
-thread_fork(const char *name, 
-	    void *data1, unsigned long data2,
-	    void (*func)(void *, unsigned long),
-	    struct thread **ret)
+thread_fork_stack(const char *name, size_t stacksize,
+		  void *data1, unsigned long data2,
+		  void (*func)(void *, unsigned long),
+		  struct thread **ret)
 {
 	struct thread *newguy;
 	int s, result;
 
 	//kprintf("enter thread_fork\n");
-	/* Allocate a thread */
-	newguy = thread_create(name);
+	/* Allocate a thread and stack (with the magic number on it) */
+	newguy = thread_create_with_stack(name, stacksize);
 	if (newguy==NULL) {
 		return ENOMEM;
 	}
 
-
-	/* Allocate a stack */
-	newguy->t_stack = kmalloc(STACK_SIZE);
-	if (newguy->t_stack==NULL) {
-		kfree(newguy->t_name);
-		kfree(newguy);
-		return ENOMEM;
-	}
-
-	/* stick a magic number on the bottom end of the stack */
-	newguy->t_stack[0] = 0xae;
-	newguy->t_stack[1] = 0x11;
-	newguy->t_stack[2] = 0xda;
-	newguy->t_stack[3] = 0x33;
+	/* Inherit the scheduling priority, but start with a fresh quantum */
+	newguy->t_basepriority = curthread->t_basepriority;
+	newguy->t_priority = curthread->t_basepriority;
+	newguy->t_tickets = curthread->t_tickets;
+	newguy->t_stride = curthread->t_stride;
+	newguy->t_pass = curthread->t_pass;
 
 	/* Inherit the current directory */
 	if (curthread->t_cwd != NULL) {
@@ -307,7 +827,8 @@ thread_fork(const char *name,
 	//kprintf("fuck2\n");
 
 	/* Set up the pcb (this arranges for func to be called) */
-	md_initpcb(&newguy->t_pcb, newguy->t_stack, data1, data2, func);
+	md_initpcb(&newguy->t_pcb, newguy->t_stack, newguy->t_stacksize,
+		   data1, data2, func);
 
 	/* Interrupts off for atomicity */
 	s = splhigh();
@@ -322,15 +843,15 @@ thread_fork(const char *name,
 	//	lock_acquire(lock);
 	//#endif
 	// place child process's pcb into process table
-	PCBs[newguy->pID] = kmalloc(sizeof(pcb_t));
+	PCBs[newguy->pID] = kmem_cache_alloc(&pcb_cache);
 	if(PCBs[newguy->pID] == NULL){
 		panic("PCBs allocateing child pcb failed");
 	}
 	PCBs[newguy->pID] -> exited = 0;
 	PCBs[newguy->pID] -> exit_code = -1;
-	PCBs[newguy->pID] -> this_thread = curthread;
+	PCBs[newguy->pID] -> this_thread = newguy;
 	PCBs[newguy->pID] -> parent = curthread-> pID;
-	PCBs[newguy->pID] -> mutex = sem_create("child_process_mux", 1);
+	bzero(&PCBs[newguy->pID]->p_rusage, sizeof(PCBs[newguy->pID]->p_rusage));
 	
 
 	/********************************************************************/
@@ -339,10 +860,6 @@ thread_fork(const char *name,
 	 * Make sure our data structures have enough space, so we won't
 	 * run out later at an inconvenient time.
 	 */
-	result = array_preallocate(sleepers, numthreads+1);
-	if (result) {
-		goto fail;
-	}
 	result = array_preallocate(zombies, numthreads+1);
 	if (result) {
 		goto fail;
@@ -389,14 +906,32 @@ thread_fork(const char *name,
 	splx(s);
 	if (newguy->t_cwd != NULL) {
 		VOP_DECREF(newguy->t_cwd);
+		newguy->t_cwd = NULL;
 	}
-	kfree(newguy->t_stack);
-	kfree(newguy->t_name);
-	kfree(newguy);
+	thread_destroy(newguy);
 
 	return result;
 }
 
+int
+thread_fork(const char *name, 
+	    void *data1, unsigned long data2,
+	    void (*func)(void *, unsigned long),
+	    struct thread **ret)
+{
+	return thread_fork_stack(name, STACK_SIZE, data1, data2, func, ret);
+}
+
+int
+thread_fork_user(const char *name, 
+		 void *data1, unsigned long data2,
+		 void (*func)(void *, unsigned long),
+		 struct thread **ret)
+{
+	return thread_fork_stack(name, thread_userstack, data1, data2, func,
+				 ret);
+}
+
 /*
  * High level, machine-independent context switch code.
  */
@@ -435,6 +970,19 @@ mi_switch(threadstate_t nextstate)
 	cur = curthread;
 	curthread = NULL;
 
+	/*
+	 * Charge the run that's ending. Going to sleep or yielding on
+	 * our own is voluntary; being yielded from an interrupt handler
+	 * (hardclock, usually) is not.
+	 */
+	rusage_chargerun(cur);
+	if (nextstate==S_SLEEP || (nextstate==S_READY && !in_interrupt)) {
+		cur->t_rusage.ru_nvcsw++;
+	}
+	else if (nextstate==S_READY) {
+		cur->t_rusage.ru_nivcsw++;
+	}
+
 	/*
 	 * Stash the current thread on whatever list it's supposed to go on.
 	 * Because we preallocate during thread_fork, this should not fail.
@@ -444,11 +992,9 @@ mi_switch(threadstate_t nextstate)
 		result = make_runnable(cur);
 	}
 	else if (nextstate==S_SLEEP) {
-		/*
-		 * Because we preallocate sleepers[] during thread_fork,
-		 * this should never fail.
-		 */
-		result = array_add(sleepers, cur);
+		/* Wait channels live in the thread structs; can't fail. */
+		wchan_enqueue(cur);
+		result = 0;
 	}
 	else {
 		assert(nextstate==S_ZOMB);
@@ -462,6 +1008,7 @@ mi_switch(threadstate_t nextstate)
 	// the call to the scheduler will return the next thread to run
 	 
 	next = scheduler();
+	schedlat_record(next, rusage_chargewait(next));
 	/* update curthread */
 	curthread = next;
 	
@@ -514,6 +1061,10 @@ thread_exit(void)
 
 	splhigh();
 
+	if (curthread->t_stack != NULL) {
+		thread_stackrecord(curthread, 1);
+	}
+
 	if (curthread->t_vmspace) {
 		/*
 		 * Do this carefully to avoid race condition with
@@ -533,6 +1084,10 @@ thread_exit(void)
 	this_pcb-> exited = 1;
 	this_pcb-> exit_code = 0;
 
+	/* Save our statistics for getrusage; the thread is about to go. */
+	rusage_chargerun(curthread);
+	rusage_add(&this_pcb->p_rusage, &curthread->t_rusage);
+
 	assert(numthreads>0);
 	numthreads--;
 
@@ -552,8 +1107,8 @@ thread_yield(void)
 {
 	int spl = splhigh();
 
-	/* Check sleepers just in case we get here after shutdown */
-	assert(sleepers != NULL);
+	/* Check zombies just in case we get here after shutdown */
+	assert(zombies != NULL);
 
 	mi_switch(S_READY);
 	splx(spl);
@@ -584,11 +1139,79 @@ thread_sleep(const void *addr)
 	curthread->t_sleepaddr = NULL;
 }
 
+/*
+ * State shared between thread_sleep_timeout and its timer.
+ */
+struct sleeptimer {
+	struct thread *st_thread;	/* the sleeper */
+	const void *st_addr;		/* what it's sleeping on */
+	volatile int *st_nwaiters;	/* count of sleepers on st_addr */
+	int st_expired;			/* set if the timer woke it */
+};
+
+/*
+ * Timeout callback for thread_sleep_timeout. If the thread is still
+ * waiting on the channel it went to sleep on, take it off, drop it
+ * from the channel's waiter count, and wake it up. If it has been
+ * woken already, or moved to another channel (as cv_signal does),
+ * leave it be; it is no longer waiting for us.
+ */
+static
+void
+thread_sleep_expire(void *arg)
+{
+	struct sleeptimer *st = arg;
+	struct thread *t = st->st_thread;
+	int result;
+
+	if (t->t_sleepaddr != st->st_addr || !wchan_remove(t)) {
+		return;
+	}
+
+	if (st->st_nwaiters != NULL) {
+		(*st->st_nwaiters)--;
+	}
+	st->st_expired = 1;
+	t->t_woken = 1;
+	scheduler_boost(t);
+	result = make_runnable(t);
+	assert(result==0);
+}
+
+/*
+ * Like thread_sleep, but give up after TICKS hardclock ticks. Returns
+ * 0 if something woke us, or ETIMEDOUT if the time ran out first.
+ * Interrupts must be off.
+ */
+int
+thread_sleep_timeout(const void *addr, int ticks, volatile int *nwaiters)
+{
+	struct sleeptimer st;
+	struct timeout to;
+
+	assert(curspl>0);
+
+	st.st_thread = curthread;
+	st.st_addr = addr;
+	st.st_nwaiters = nwaiters;
+	st.st_expired = 0;
+
+	timeout_add(&to, ticks, thread_sleep_expire, &st);
+	thread_sleep(addr);
+	timeout_del(&to);
+
+	return st.st_expired ? ETIMEDOUT : 0;
+}
+
 void display(){
-	int i = 0;
-	for(;i<array_getnum(sleepers);i++){
-		struct thread* temp = array_getguy(sleepers,i);
-		kprintf("thread %d = %d\n", temp->pID,i);
+	int i;
+	struct thread *chan, *t;
+	for(i=0;i<NWCHANS;i++){
+		for(chan=wchans[i];chan!=NULL;chan=chan->t_wchan_next){
+			for(t=chan;t!=NULL;t=t->t_wq_next){
+				kprintf("thread %d sleeping on %p\n", t->pID, t->t_sleepaddr);
+			}
+		}
 	}
 }
 
@@ -599,70 +1222,91 @@ void display(){
 void
 thread_wakeup(const void *addr)
 {
-	int i, result;
+	struct thread **link, *t, *next;
+	int result;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	// This is inefficient. Feel free to improve it.
-	// improvement 1: loop invariant array_getnum(sleepers)
-	// int num_sleepers = array_getnum(sleepers);
-	// if(numthreads>1)
-	// 	display();
-	for (i=0; i < array_getnum(sleepers); i++) {
-
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			// must look at the same sleepers[i] again
-			i--;
-
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-			result = make_runnable(t);
-			assert(result==0);
-		}
+	link = wchan_lookup(addr);
+	t = *link;
+	if (t == NULL) {
+		return;
+	}
+
+	/* Unhook the whole channel, then wake its threads in order. */
+	*link = t->t_wchan_next;
+
+	for (; t != NULL; t = next) {
+		next = t->t_wq_next;
+		t->t_wchan_next = NULL;
+		t->t_wq_next = NULL;
+		t->t_wq_tail = NULL;
+		numsleepers--;
+
+		/*
+		 * Because we preallocate during thread_fork,
+		 * this should never fail.
+		 */
+		t->t_woken = 1;
+		scheduler_boost(t);
+		result = make_runnable(t);
+		assert(result==0);
 	}
 }
 
-void
+/*
+ * Wake up the thread that has been sleeping longest on ADDR, if any.
+ * Returns the thread woken, or NULL.
+ */
+struct thread *
 thread_wakeup_single (const void *addr)
 {
-	int i, result;
+	struct thread **link, *t;
+	int result;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	// This is inefficient. Feel free to improve it.
-	// improvement 1: loop invariant array_getnum(sleepers)
-	// int num_sleepers = array_getnum(sleepers);
-//	kprintf("wake process %d 's sleeping process on %d\n",curthread->pID,(int)addr);
-	for (i=0; i < array_getnum(sleepers); i++) {
-
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-		//	kprintf("we will have put process %d into the run queue\n",t->pID);
-			result = make_runnable(t);
-			//kprintf("we haveb put process %d into the run queue\n",t->pID);
-			assert(result==0);
-			return;
-		}
+
+	link = wchan_lookup(addr);
+	if (*link == NULL) {
+		return NULL;
+	}
+
+	t = wchan_remhead(link);
+
+	/*
+	 * Because we preallocate during thread_fork,
+	 * this should never fail.
+	 */
+	t->t_woken = 1;
+	scheduler_boost(t);
+	result = make_runnable(t);
+	assert(result==0);
+	return t;
+}
+
+/*
+ * Move the thread that has been sleeping longest on FROM to the end
+ * of the queue of threads sleeping on TO, without waking it. Returns
+ * the thread moved, or NULL if nothing was sleeping on FROM.
+ */
+struct thread *
+thread_wchan_move(const void *from, const void *to)
+{
+	struct thread **link, *t;
+
+	assert(curspl>0);
+
+	link = wchan_lookup(from);
+	if (*link == NULL) {
+		return NULL;
 	}
 
-	//kprintf(" process is about to leave thread_wakeup_single\n");
+	t = wchan_remhead(link);
+	t->t_sleepaddr = to;
+	wchan_enqueue(t);
+	return t;
 }
 
 /*
@@ -672,18 +1316,27 @@ thread_wakeup_single (const void *addr)
 int
 thread_hassleepers(const void *addr)
 {
-	int i;
-	
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			return 1;
+	return *wchan_lookup(addr) != NULL;
+}
+
+int
+thread_sleepers_level(const void *addr)
+{
+	struct thread *t;
+	int level, best = SCHED_NLEVELS;
+
+	assert(curspl>0);
+
+	for (t = *wchan_lookup(addr); t != NULL; t = t->t_wq_next) {
+		level = scheduler_level(t);
+		if (level < best) {
+			best = level;
 		}
 	}
-	return 0;
+	return best;
 }
 
 /*
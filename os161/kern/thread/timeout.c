@@ -0,0 +1,197 @@
+/*
+ * Kernel timers.
+ *
+ * Pending timeouts are kept in a hashed timing wheel: an array of
+ * TIMEOUT_WHEELSIZE slots, where a timeout due at tick T lives in
+ * slot T % TIMEOUT_WHEELSIZE. Adding and cancelling are O(1). Each
+ * tick, hardclock looks at one slot and fires whatever in it is due
+ * now; timeouts more than a full turn away just stay put until their
+ * turn comes around.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <timeout.h>
+
+#define TIMEOUT_WHEELSIZE 128	/* must be a power of 2 */
+#define WHEELSLOT(t) ((t) & (TIMEOUT_WHEELSIZE-1))
+
+static struct timeout *wheel[TIMEOUT_WHEELSIZE];
+
+/* Ticks since boot. */
+static u_int32_t now;
+
+/* Number of timeouts on the wheel. */
+static int numpending;
+
+/*
+ * Link TO in at the head of the list *HEAD.
+ */
+static
+void
+timeout_link(struct timeout **head, struct timeout *to)
+{
+	to->to_next = *head;
+	if (to->to_next != NULL) {
+		to->to_next->to_prevp = &to->to_next;
+	}
+	to->to_prevp = head;
+	*head = to;
+}
+
+/*
+ * Unlink TO from whatever list it's on.
+ */
+static
+void
+timeout_unlink(struct timeout *to)
+{
+	*to->to_prevp = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_prevp = to->to_prevp;
+	}
+	to->to_next = NULL;
+	to->to_prevp = NULL;
+}
+
+void
+timeout_add(struct timeout *to, int ticks, void (*fn)(void *), void *arg)
+{
+	int spl;
+
+	if (ticks < 1) {
+		ticks = 1;
+	}
+
+	spl = splhigh();
+
+	to->to_expire = now + ticks;
+	to->to_fn = fn;
+	to->to_arg = arg;
+	timeout_link(&wheel[WHEELSLOT(to->to_expire)], to);
+	numpending++;
+
+	splx(spl);
+}
+
+int
+timeout_del(struct timeout *to)
+{
+	int spl, pending;
+
+	spl = splhigh();
+
+	pending = (to->to_prevp != NULL);
+	if (pending) {
+		timeout_unlink(to);
+		numpending--;
+	}
+
+	splx(spl);
+	return pending;
+}
+
+int
+timeout_pending(struct timeout *to)
+{
+	return to->to_prevp != NULL;
+}
+
+u_int32_t
+timeout_ticks(void)
+{
+	return now;
+}
+
+/*
+ * Advance the clock and fire everything that's due.
+ */
+void
+timeout_tick(void)
+{
+	struct timeout *to, *next, *expired;
+
+	assert(curspl>0);
+
+	now++;
+
+	/*
+	 * Move the ones that are due onto a private list first, so the
+	 * callbacks can add and delete timeouts (including each other)
+	 * without upsetting the walk through the slot.
+	 */
+	expired = NULL;
+	for (to = wheel[WHEELSLOT(now)]; to != NULL; to = next) {
+		next = to->to_next;
+		if (to->to_expire == now) {
+			timeout_unlink(to);
+			timeout_link(&expired, to);
+		}
+	}
+
+	while (expired != NULL) {
+		to = expired;
+		timeout_unlink(to);
+		numpending--;
+		to->to_fn(to->to_arg);
+	}
+}
+
+/*
+ * Return how many ticks it is until the next timeout fires, or MAX
+ * if that's further off. Used by tickless idle.
+ */
+int
+timeout_nextevent(int max)
+{
+	struct timeout *to;
+	int i;
+
+	assert(curspl>0);
+
+	if (numpending == 0) {
+		return max;
+	}
+
+	/*
+	 * Anything further off than one turn of the wheel shares a slot
+	 * with something nearer, so only look one turn ahead; past that
+	 * we just say to come back in a turn.
+	 */
+	if (max > TIMEOUT_WHEELSIZE) {
+		max = TIMEOUT_WHEELSIZE;
+	}
+
+	for (i=1; i<max; i++) {
+		for (to = wheel[WHEELSLOT(now+i)]; to != NULL; to = to->to_next) {
+			if (to->to_expire == now+i) {
+				return i;
+			}
+		}
+	}
+	return max;
+}
+
+/*
+ * Timeout callback for thread_sleep_ticks.
+ */
+static
+void
+sleep_ticks_wakeup(void *addr)
+{
+	thread_wakeup(addr);
+}
+
+void
+thread_sleep_ticks(int ticks)
+{
+	struct timeout to;
+	int spl;
+
+	spl = splhigh();
+	timeout_add(&to, ticks, sleep_ticks_wakeup, &to);
+	thread_sleep(&to);
+	splx(spl);
+}
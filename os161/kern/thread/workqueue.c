@@ -0,0 +1,272 @@
+/*
+ * Deferred work.
+ *
+ * Each workqueue is a FIFO of struct work plus some worker threads
+ * that sleep on the workqueue when it's empty. Adding an item only
+ * links it in and wakes a worker, so it costs an interrupt handler
+ * next to nothing; the item runs when the scheduler gets to the
+ * worker, with interrupts on.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <workqueue.h>
+
+/* Number of worker threads for the system workqueue. */
+#define SYSWQ_NWORKERS 2
+
+struct workqueue {
+	char *wq_name;
+	struct work *wq_head;		/* pending items */
+	struct work *wq_tail;
+	struct workqueue *wq_nextwq;	/* list of all workqueues */
+	int wq_nworkers;		/* worker threads still running */
+	int wq_dying;			/* set to tell the workers to exit */
+
+	/* statistics */
+	int wq_depth;			/* items queued now */
+	int wq_maxdepth;		/* most ever queued at once */
+	u_int32_t wq_nadded;		/* calls to workqueue_add */
+	u_int32_t wq_nrun;		/* items actually run */
+};
+
+/* All workqueues, for printing statistics. */
+static struct workqueue *allqueues;
+
+/* The system workqueue. */
+static struct workqueue *syswq;
+
+void
+work_init(struct work *w, void (*fn)(void *), void *arg)
+{
+	w->w_next = NULL;
+	w->w_fn = fn;
+	w->w_arg = arg;
+	w->w_queued = 0;
+}
+
+void
+workqueue_add(struct workqueue *wq, struct work *w)
+{
+	int spl;
+
+	spl = splhigh();
+
+	wq->wq_nadded++;
+	if (!w->w_queued) {
+		w->w_queued = 1;
+		w->w_next = NULL;
+		if (wq->wq_tail == NULL) {
+			wq->wq_head = w;
+		}
+		else {
+			wq->wq_tail->w_next = w;
+		}
+		wq->wq_tail = w;
+
+		wq->wq_depth++;
+		if (wq->wq_depth > wq->wq_maxdepth) {
+			wq->wq_maxdepth = wq->wq_depth;
+		}
+		thread_wakeup_single(wq);
+	}
+
+	splx(spl);
+}
+
+void
+workqueue_schedule(struct work *w)
+{
+	if (syswq == NULL) {
+		/* Too early (or late) for threads; just do it. */
+		w->w_fn(w->w_arg);
+		return;
+	}
+	workqueue_add(syswq, w);
+}
+
+/*
+ * Take the first item off WQ. Interrupts must be off.
+ */
+static
+struct work *
+workqueue_remhead(struct workqueue *wq)
+{
+	struct work *w;
+
+	assert(curspl>0);
+
+	w = wq->wq_head;
+	if (w != NULL) {
+		wq->wq_head = w->w_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tail = NULL;
+		}
+		w->w_next = NULL;
+		w->w_queued = 0;
+		wq->wq_depth--;
+	}
+	return w;
+}
+
+/*
+ * Worker thread. Runs items until told to exit and the queue is
+ * empty.
+ */
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct work *w;
+
+	(void)data2;
+
+	splhigh();
+	while (1) {
+		while (wq->wq_head == NULL && !wq->wq_dying) {
+			thread_sleep(wq);
+		}
+
+		w = workqueue_remhead(wq);
+		if (w == NULL) {
+			break;
+		}
+		wq->wq_nrun++;
+
+		/*
+		 * w_queued was cleared when it came off the queue, so an
+		 * add that comes in while it's running queues it again
+		 * rather than getting lost.
+		 */
+		spl0();
+		w->w_fn(w->w_arg);
+		splhigh();
+	}
+
+	wq->wq_nworkers--;
+	thread_wakeup(&wq->wq_nworkers);
+	spl0();
+
+	thread_exit();
+}
+
+struct workqueue *
+workqueue_create(const char *name, int nworkers)
+{
+	struct workqueue *wq;
+	char tname[32];
+	int i, result, spl;
+
+	assert(nworkers > 0);
+
+	wq = kmalloc(sizeof(struct workqueue));
+	if (wq == NULL) {
+		return NULL;
+	}
+	wq->wq_name = kstrdup(name);
+	if (wq->wq_name == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	wq->wq_head = wq->wq_tail = NULL;
+	wq->wq_nworkers = 0;
+	wq->wq_dying = 0;
+	wq->wq_depth = wq->wq_maxdepth = 0;
+	wq->wq_nadded = wq->wq_nrun = 0;
+
+	for (i=0; i<nworkers; i++) {
+		snprintf(tname, sizeof(tname), "%s/%d", name, i);
+		result = thread_fork(tname, wq, 0, workqueue_worker, NULL);
+		if (result) {
+			if (i == 0) {
+				kfree(wq->wq_name);
+				kfree(wq);
+				return NULL;
+			}
+			/* Make do with the ones we got. */
+			break;
+		}
+		spl = splhigh();
+		wq->wq_nworkers++;
+		splx(spl);
+	}
+
+	spl = splhigh();
+	wq->wq_nextwq = allqueues;
+	allqueues = wq;
+	splx(spl);
+
+	return wq;
+}
+
+void
+workqueue_destroy(struct workqueue *wq)
+{
+	struct workqueue **p;
+	int spl;
+
+	spl = splhigh();
+
+	wq->wq_dying = 1;
+	thread_wakeup(wq);
+	while (wq->wq_nworkers > 0) {
+		thread_sleep(&wq->wq_nworkers);
+	}
+	assert(wq->wq_head == NULL);
+
+	for (p = &allqueues; *p != wq; p = &(*p)->wq_nextwq) {
+		assert(*p != NULL);
+	}
+	*p = wq->wq_nextwq;
+
+	splx(spl);
+
+	kfree(wq->wq_name);
+	kfree(wq);
+}
+
+void
+workqueue_bootstrap(void)
+{
+	syswq = workqueue_create("syswq", SYSWQ_NWORKERS);
+	if (syswq == NULL) {
+		panic("workqueue_bootstrap: Out of memory\n");
+	}
+}
+
+void
+workqueue_shutdown(void)
+{
+	struct workqueue *wq = syswq;
+
+	if (wq == NULL) {
+		return;
+	}
+
+	/* Anything queued from here on is run directly. */
+	syswq = NULL;
+	workqueue_destroy(wq);
+}
+
+void
+workqueue_printstats(void)
+{
+	struct workqueue *wq;
+	int spl;
+
+	spl = splhigh();
+
+	kprintf("%-12s %7s %5s %8s %10s %10s\n",
+		"workqueue", "workers", "depth", "maxdepth", "added", "run");
+	for (wq = allqueues; wq != NULL; wq = wq->wq_nextwq) {
+		kprintf("%-12s %7d %5d %8d %10lu %10lu\n", wq->wq_name,
+			wq->wq_nworkers, wq->wq_depth, wq->wq_maxdepth,
+			(unsigned long) wq->wq_nadded,
+			(unsigned long) wq->wq_nrun);
+	}
+
+	splx(spl);
+}
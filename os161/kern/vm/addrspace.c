@@ -6,6 +6,7 @@
 #include <bitmap.h>
 #include <machine/tlb.h>
 #include <elf.h>
+#include <kmem_cache.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -17,6 +18,18 @@ extern size_t num_frames;
 extern frame* coremap;
 extern struct bitmap* swapfile_map;
 
+/*
+ * Regions and second-level page tables come and go with every fork,
+ * exec and exit, so they're kept in object caches. A page table is
+ * zeroed by whoever allocates it, not by a constructor, since it's
+ * not zero when it's freed.
+ */
+static struct kmem_cache as_region_cache =
+	KMEM_CACHE_INIT("as_region", sizeof(struct as_region), NULL, NULL);
+struct kmem_cache as_pagetable_cache =
+	KMEM_CACHE_INIT("as_pagetable", sizeof(struct as_pagetable),
+			NULL, NULL);
+
 /*
 	in as_create, we just allocate a addrspace structure using kmalloc, and allocate a physical 
 	page (using page_alloc) as page directory and store it's address (either KVADDR or PADDR is OK, 
@@ -71,7 +84,7 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	// first all regions
 	unsigned int i;
 	for (i = 0; i < array_getnum(old->as_regions); i++) {
-		struct as_region* temp = kmalloc(sizeof(struct as_region));
+		struct as_region* temp = kmem_cache_alloc(&as_region_cache);
 		*temp = *((struct as_region*)array_getguy(old->as_regions, i));
 		array_add(newas->as_regions, temp);
 	}
@@ -84,7 +97,7 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	// then both the first and second page table
 	for (i = 0; i < FIRST_LEVEL_PT_SIZE; i++) {
 		if(old->as_master_pagetable[i] != NULL) {
-			newas->as_master_pagetable[i] = (struct as_pagetable*)kmalloc(sizeof(struct as_pagetable));
+			newas->as_master_pagetable[i] = kmem_cache_alloc(&as_pagetable_cache);
 			// what the f**k am i doing?
 			// the right thing to do here is to go through all PTEs of the old addrspace, if there's a 
 			// valid PTE, meaning there's a page, be it PRESENT or SWAPPED, belonging to this addrspace.
@@ -152,11 +165,8 @@ as_destroy(struct addrspace *as)
 	int i = 0;
 	//free all coremap entries
 	for (; i < num_frames; i++) {
-		if(coremap[i].state != FREE && coremap[i].addrspace == as){
-			coremap[i].addrspace = NULL;
-			coremap[i].mapped_vaddr = 0;
-			coremap[i].state = FREE;
-			coremap[i].num_pages_allocated = 0;
+		if(!FRAME_IS_FREE(coremap[i]) && coremap[i].addrspace == as){
+			coremap_setfree(i);
 		}
 	}
 	// free all pages in the swap file
@@ -217,11 +227,16 @@ as_destroy(struct addrspace *as)
 
 	/*************************** Free Internals *************************/
 	// first all regions
+	for (i = 0; i < array_getnum(as->as_regions); i++) {
+		kmem_cache_free(&as_region_cache,
+				array_getguy(as->as_regions, i));
+	}
 	array_destroy(as->as_regions);
 	// free 2nd level page tables
 	for(i = 0; i < FIRST_LEVEL_PT_SIZE; i++) {
 		if(as->as_master_pagetable[i] != NULL)
-			kfree(as->as_master_pagetable[i]);
+			kmem_cache_free(&as_pagetable_cache,
+					as->as_master_pagetable[i]);
 	}
 	kfree(as);
 	splx(spl);
@@ -272,7 +287,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	npages = sz / PAGE_SIZE;
 
 	// create and insert the region 
-	struct as_region *new_region = kmalloc(sizeof(struct as_region));
+	struct as_region *new_region = kmem_cache_alloc(&as_region_cache);
 	new_region->vbase = vaddr;
 	new_region->npages = npages;
 	// the region permission is the lower 3 bits R|W|X
@@ -0,0 +1,14 @@
+
+heapstat.o: \
+ heapstat.c \
+ $(OSTREE)/include/stdio.h \
+ $(OSTREE)/include/sys/types.h \
+ $(OSTREE)/include/machine/types.h \
+ $(OSTREE)/include/kern/types.h \
+ $(OSTREE)/include/stdarg.h \
+ $(OSTREE)/include/stdlib.h \
+ $(OSTREE)/include/unistd.h \
+ $(OSTREE)/include/kern/unistd.h \
+ $(OSTREE)/include/sys/kheapstat.h \
+ $(OSTREE)/include/kern/kheapstat.h \
+ $(OSTREE)/include/err.h
@@ -0,0 +1,163 @@
+/*
+ * heapstat - report kernel heap usage and fragmentation.
+ *
+ * Prints the size-class table, the request size histogram and the
+ * page frame figures from kheapstats. Given an interval, keeps
+ * sampling and prints what changed since the last sample, so it can
+ * be left running beside a soak test to see whether the heap is
+ * leaking, what sizes it is being asked for, or whether the free
+ * frames are breaking up.
+ *
+ * Usage: heapstat [interval [count]]
+ *   interval is in seconds; count is how many samples to take after
+ *   the first (default: go on forever).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/kheapstat.h>
+#include <err.h>
+
+/*
+ * Print the label for request size histogram bucket I, the same way
+ * the kernel's own report does.
+ */
+static
+void
+printbucket(unsigned i)
+{
+	unsigned long limit = (unsigned long)KHS_HISTMIN << i;
+
+	if (i < KHS_NHIST-1) {
+		printf("<= %-6lu", limit);
+	}
+	else {
+		printf(" > %-6lu", limit/2);
+	}
+}
+
+static
+void
+printstats(const struct kheapstats *ks)
+{
+	unsigned i;
+
+	printf("%5s %6s %7s %7s %10s %5s\n", "size", "pages", "partial",
+	       "inuse", "allocs", "used");
+	for (i=0; i<KHS_NCLASSES; i++) {
+		printf("%5lu %6lu %7lu %7lu %10lu ",
+		       (unsigned long) ks->khs_size[i],
+		       (unsigned long) ks->khs_pages[i],
+		       (unsigned long) ks->khs_partial[i],
+		       (unsigned long) ks->khs_inuse[i],
+		       (unsigned long) ks->khs_nalloc[i]);
+		if (ks->khs_nalloc[i] == 0) {
+			printf("%5s\n", "-");
+		}
+		else {
+			/* reqbytes wraps long before this would */
+			printf("%4lu%%\n", (unsigned long)
+			       (ks->khs_reqbytes[i] / ks->khs_nalloc[i]
+				* 100 / ks->khs_size[i]));
+		}
+	}
+	printf("Whole pages: %lu allocs, %lu pages\n",
+	       (unsigned long) ks->khs_bignalloc,
+	       (unsigned long) ks->khs_bigpages);
+	printf("Request sizes:\n");
+	for (i=0; i<KHS_NHIST; i++) {
+		printf("  ");
+		printbucket(i);
+		printf(" %10lu\n", (unsigned long) ks->khs_hist[i]);
+	}
+	printf("Page frames: %lu managed, %lu free; largest free run %lu, "
+	       "largest free block %lu\n",
+	       (unsigned long) ks->khs_frames,
+	       (unsigned long) ks->khs_freeframes,
+	       (unsigned long) ks->khs_largestrun,
+	       (unsigned long) ks->khs_largestblock);
+}
+
+/*
+ * Print the change from OLD to NEW on one line. The totals are
+ * unsigned and wrap, so plain subtraction gives the right difference.
+ */
+static
+void
+printdelta(const struct kheapstats *old, const struct kheapstats *new)
+{
+	u_int32_t nalloc = 0;
+	int inuse = 0;
+	unsigned i;
+
+	for (i=0; i<KHS_NCLASSES; i++) {
+		nalloc += new->khs_nalloc[i] - old->khs_nalloc[i];
+		inuse += (int)new->khs_inuse[i] - (int)old->khs_inuse[i];
+	}
+	nalloc += new->khs_bignalloc - old->khs_bignalloc;
+
+	printf("allocs +%lu, blocks in use %d more, free frames %lu "
+	       "(%d more), largest run %lu\n",
+	       (unsigned long) nalloc, inuse,
+	       (unsigned long) new->khs_freeframes,
+	       (int)new->khs_freeframes - (int)old->khs_freeframes,
+	       (unsigned long) new->khs_largestrun);
+
+	/* and which sizes the new allocations were */
+	for (i=0; i<KHS_NHIST; i++) {
+		if (new->khs_hist[i] != old->khs_hist[i]) {
+			printf("  ");
+			printbucket(i);
+			printf(" +%lu", (unsigned long)
+			       (new->khs_hist[i] - old->khs_hist[i]));
+		}
+	}
+	if (nalloc > 0) {
+		printf("\n");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct kheapstats ks[2];
+	int interval = 0, count = -1;
+	int cur = 0;
+
+	if (argc > 3) {
+		errx(1, "Usage: heapstat [interval [count]]");
+	}
+	if (argc > 1) {
+		interval = atoi(argv[1]);
+		if (interval <= 0) {
+			errx(1, "heapstat: bad interval %s", argv[1]);
+		}
+	}
+	if (argc > 2) {
+		count = atoi(argv[2]);
+	}
+
+	if (kheapstats(&ks[cur])) {
+		err(1, "kheapstats");
+	}
+	printstats(&ks[cur]);
+
+	if (interval == 0) {
+		return 0;
+	}
+	while (count != 0) {
+		if (nanosleep(interval, 0)) {
+			err(1, "nanosleep");
+		}
+		if (kheapstats(&ks[!cur])) {
+			err(1, "kheapstats");
+		}
+		printdelta(&ks[cur], &ks[!cur]);
+		cur = !cur;
+		if (count > 0) {
+			count--;
+		}
+	}
+	return 0;
+}
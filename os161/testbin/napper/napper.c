@@ -0,0 +1,94 @@
+/*
+ * napper - test nanosleep.
+ *
+ * Sleeps for a range of intervals, from a few milliseconds up to a
+ * second, and checks against the realtime clock that each sleep took
+ * at least as long as asked for and not much longer.
+ *
+ * Usage: napper [count]
+ *   count is how many times to sleep at each interval (default 5).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+/* How far over the requested time a sleep may run (usecs). */
+#define SLOP  30000
+
+static const unsigned long intervals[] = {
+	1000, 5000, 10000, 25000, 100000, 500000, 1000000,
+};
+#define NINTERVALS (sizeof(intervals)/sizeof(intervals[0]))
+
+static
+unsigned long
+usecs_between(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	if (ns2 < ns1) {
+		ns2 += 1000000000;
+		s2--;
+	}
+	return (s2 - s1) * 1000000 + (ns2 - ns1) / 1000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	time_t s1, s2;
+	unsigned long ns1, ns2, want, got, worst;
+	int count, i, bad = 0;
+	unsigned j;
+
+	count = 5;
+	if (argc == 2) {
+		count = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: napper [count]");
+	}
+
+	for (j=0; j<NINTERVALS; j++) {
+		want = intervals[j];
+		worst = 0;
+		for (i=0; i<count; i++) {
+			__time(&s1, &ns1);
+			if (nanosleep(want / 1000000,
+				      (want % 1000000) * 1000)) {
+				err(1, "nanosleep");
+			}
+			__time(&s2, &ns2);
+
+			got = usecs_between(s1, ns1, s2, ns2);
+			if (got < want) {
+				printf("napper: asked for %lu us, slept %lu us\n",
+				       want, got);
+				bad = 1;
+			}
+			if (got > worst) {
+				worst = got;
+			}
+		}
+		printf("napper: %7lu us: longest sleep %7lu us%s\n",
+		       want, worst, worst > want + SLOP ? " (slow)" : "");
+	}
+
+	/* Zero-length sleeps should just yield. */
+	if (nanosleep(0, 0)) {
+		err(1, "nanosleep(0, 0)");
+	}
+
+	/* Bad arguments. */
+	if (nanosleep(0, 1000000000) == 0) {
+		printf("napper: nanosleep accepted 1000000000 ns\n");
+		bad = 1;
+	}
+	if (nanosleep(-1, 0) == 0) {
+		printf("napper: nanosleep accepted -1 seconds\n");
+		bad = 1;
+	}
+
+	printf("napper: %s\n", bad ? "FAILED" : "passed");
+	return bad;
+}
@@ -0,0 +1,155 @@
+/*
+ * stride - test proportional-share scheduling.
+ *
+ * Puts two CPU-bound children in the stride scheduling class with
+ * SHARE_A and SHARE_B tickets (set on the parent before each fork,
+ * so this also checks that the setting is inherited), lets them run
+ * against each other for WINDOW seconds, and checks with getrusage
+ * that the CPU time they got is in proportion to their tickets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <err.h>
+
+#define SHARE_A    1
+#define SHARE_B    3
+#define WINDOW     5		/* seconds */
+#define TOLERANCE  15		/* percent */
+
+/*
+ * Microseconds from S1/NS1 until S2/NS2, or 0 if that's in the past.
+ */
+static
+unsigned long
+usecs_until(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	if (s2 < s1 || (s2 == s1 && ns2 <= ns1)) {
+		return 0;
+	}
+	if (ns2 < ns1) {
+		ns2 += 1000000000;
+		s2--;
+	}
+	return (s2 - s1) * 1000000 + (ns2 - ns1) / 1000;
+}
+
+static
+void
+sleep_until(time_t s, unsigned long ns)
+{
+	time_t nows;
+	unsigned long nowns, us;
+
+	__time(&nows, &nowns);
+	us = usecs_until(nows, nowns, s, ns);
+	if (us > 0 && nanosleep(us / 1000000, (us % 1000000) * 1000)) {
+		err(1, "nanosleep");
+	}
+}
+
+static
+void
+spin_until(time_t s, unsigned long ns)
+{
+	time_t nows;
+	unsigned long nowns;
+
+	do {
+		__time(&nows, &nowns);
+	} while (usecs_until(nows, nowns, s, ns) > 0);
+}
+
+static
+unsigned long
+runusecs(const struct rusage *ru)
+{
+	return ru->ru_runsecs * 1000000 + ru->ru_runusecs;
+}
+
+static
+pid_t
+spawn(int tickets, time_t start, time_t stop)
+{
+	pid_t pid;
+	int got;
+
+	if (setshare(0, tickets) < 0) {
+		err(1, "setshare");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		got = setshare(0, -1);
+		if (got != tickets) {
+			warnx("child has %d tickets, expected %d", got, tickets);
+			_exit(1);
+		}
+		sleep_until(start, 0);
+		spin_until(stop, 0);
+		_exit(0);
+	}
+	return pid;
+}
+
+int
+main(void)
+{
+	time_t now, start, stop;
+	unsigned long ns, a, b, ratio, lo, hi;
+	struct rusage a0, a1, b0, b1;
+	pid_t pida, pidb;
+	int status;
+
+	__time(&now, &ns);
+	start = now + 2;
+	stop = start + WINDOW + 2;
+
+	pida = spawn(SHARE_A, start, stop);
+	pidb = spawn(SHARE_B, start, stop);
+	if (setshare(0, 0) < 0) {
+		err(1, "setshare");
+	}
+
+	/* Give them a second to get going, then measure. */
+	sleep_until(start + 1, 0);
+	if (getrusage(pida, &a0) || getrusage(pidb, &b0)) {
+		err(1, "getrusage");
+	}
+	sleep_until(start + 1 + WINDOW, 0);
+	if (getrusage(pida, &a1) || getrusage(pidb, &b1)) {
+		err(1, "getrusage");
+	}
+
+	waitpid(pida, &status, 0);
+	waitpid(pidb, &status, 0);
+
+	a = runusecs(&a1) - runusecs(&a0);
+	b = runusecs(&b1) - runusecs(&b0);
+	printf("stride: %d tickets got %lu us, %d tickets got %lu us\n",
+	       SHARE_A, a, SHARE_B, b);
+
+	if (a == 0) {
+		printf("stride: FAILED (first child got no CPU)\n");
+		return 1;
+	}
+
+	/* Ratios are in percent. */
+	ratio = b * 100 / a;
+	lo = SHARE_B * 100 / SHARE_A * (100 - TOLERANCE) / 100;
+	hi = SHARE_B * 100 / SHARE_A * (100 + TOLERANCE) / 100;
+	printf("stride: ratio %lu.%02lu, expected %d.00 +/- %d%%\n",
+	       ratio / 100, ratio % 100, SHARE_B / SHARE_A, TOLERANCE);
+
+	if (ratio < lo || ratio > hi) {
+		printf("stride: FAILED\n");
+		return 1;
+	}
+	printf("stride: passed\n");
+	return 0;
+}